@@ -0,0 +1,119 @@
+/*
+Glyph map microbenchmark for SDL_FontCache.
+
+Fills a font's glyph map through FC_SetGlyphData() and times FC_GetGlyphData()
+for codepoints served by the direct table and by the hash table, without
+loading a TTF font or creating a renderer.
+
+Usage: glyph_map_bench [lookups per set]
+*/
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "SDL_FontCache.h"
+
+#define BENCH_DEFAULT_LOOKUPS 10000000
+// Large table, roughly the CJK Unified Ideographs block
+#define BENCH_DENSE_FIRST 0x4E00
+#define BENCH_DENSE_COUNT 20000
+// Codepoints one table size apart, all of them collide if the hash only keeps low bits
+#define BENCH_STRIDED_COUNT 256
+#define BENCH_STRIDE 4096
+
+typedef struct BenchSet
+{
+    const char* name;
+    Uint32* codepoints;
+    int count;
+} BenchSet;
+
+static void fill_font(FC_Font* font, const Uint32* codepoints, int count)
+{
+    FC_GlyphData glyph;
+    int i;
+    for(i = 0; i < count; ++i)
+    {
+        glyph.rect.x = i;
+        glyph.rect.y = 0;
+        glyph.rect.w = 1 + (i & 7);
+        glyph.rect.h = 1;
+        glyph.cache_level = 0;
+        FC_SetGlyphData(font, codepoints[i], glyph);
+    }
+}
+
+// Returns the mean time of one lookup in nanoseconds
+static double time_lookups(FC_Font* font, const BenchSet* set, int lookups)
+{
+    FC_GlyphData glyph;
+    volatile int sink = 0;
+    Uint64 start, end;
+    int i, c = 0;
+
+    start = SDL_GetPerformanceCounter();
+    for(i = 0; i < lookups; ++i)
+    {
+        if(FC_GetGlyphData(font, &glyph, set->codepoints[c]))
+            sink = sink + glyph.rect.w;
+        if(++c == set->count)
+            c = 0;
+    }
+    end = SDL_GetPerformanceCounter();
+
+    return (double)(end - start) * 1e9 / (double)SDL_GetPerformanceFrequency() / lookups;
+}
+
+int main(int argc, char* argv[])
+{
+    int lookups = (argc > 1)? atoi(argv[1]) : BENCH_DEFAULT_LOOKUPS;
+    Uint32 ascii[95];
+    Uint32 dense[BENCH_DENSE_COUNT];
+    Uint32 strided[BENCH_STRIDED_COUNT];
+    BenchSet sets[3];
+    FC_Font* font;
+    FC_Font* strided_font;
+    int i;
+
+    if(lookups <= 0)
+    {
+        fprintf(stderr, "Usage: %s [lookups per set]\n", argv[0]);
+        return 1;
+    }
+
+    for(i = 0; i < 95; ++i)
+        ascii[i] = ' ' + i;
+    for(i = 0; i < BENCH_DENSE_COUNT; ++i)
+        dense[i] = BENCH_DENSE_FIRST + i;
+    for(i = 0; i < BENCH_STRIDED_COUNT; ++i)
+        strided[i] = (i + 1) * BENCH_STRIDE;
+
+    // ASCII and the dense block share one font, like a font with a large loading string
+    font = FC_CreateFont();
+    fill_font(font, ascii, 95);
+    fill_font(font, dense, BENCH_DENSE_COUNT);
+
+    strided_font = FC_CreateFont();
+    fill_font(strided_font, strided, BENCH_STRIDED_COUNT);
+
+    sets[0].name = "ascii (direct)";
+    sets[0].codepoints = ascii;
+    sets[0].count = 95;
+    sets[1].name = "dense >= 256 (hashed)";
+    sets[1].codepoints = dense;
+    sets[1].count = BENCH_DENSE_COUNT;
+    sets[2].name = "strided >= 256 (hashed)";
+    sets[2].codepoints = strided;
+    sets[2].count = BENCH_STRIDED_COUNT;
+
+    printf("%d lookups per set\n", lookups);
+    for(i = 0; i < 3; ++i)
+    {
+        FC_Font* set_font = (i == 2)? strided_font : font;
+        printf("%-24s %6.2f ns (%u cached codepoints)\n", sets[i].name, time_lookups(set_font, &sets[i], lookups), FC_GetNumCodepoints(set_font));
+    }
+
+    FC_FreeFont(strided_font);
+    FC_FreeFont(font);
+    return 0;
+}
@@ -227,6 +227,12 @@ unsigned int FC_GetTabWidth(void);
 /*! Changes the width of a horizontal tab in multiples of the width of a space (default: 4) */
 void FC_SetTabWidth(unsigned int width_in_spaces);
 
+/*! Returns the directory used for on-disk glyph atlases, or NULL if the atlas cache is disabled (default). */
+const char* FC_GetAtlasCacheDir(void);
+
+/*! Sets the directory (which must exist) where FC_LoadFont() stores the packed glyph atlas of the loading string, keyed by a hash of the font file, point size, style and loading string.  Later loads with the same key map the atlas and upload it instead of rasterizing every glyph.  Pass NULL to disable. */
+void FC_SetAtlasCacheDir(const char* directory);
+
 void FC_SetRenderCallback(FC_Rect (*callback)(FC_Image* src, FC_Rect* srcrect, FC_Target* dest, float x, float y, float xscale, float yscale));
 
 FC_Rect FC_DefaultRenderCallback(FC_Image* src, FC_Rect* srcrect, FC_Target* dest, float x, float y, float xscale, float yscale);
@@ -247,6 +253,9 @@ Uint8 FC_SetGlyphCacheLevel(FC_Font* font, int cache_level, FC_Image* cache_text
 /*! Copies the given surface to the given cache level as a texture.  New cache levels must be sequential. */
 Uint8 FC_UploadGlyphCache(FC_Font* font, int cache_level, SDL_Surface* data_surface);
 
+/*! Returns the CPU copy of the given cache level (white glyphs, coverage in alpha) kept next to the texture, or NULL if the level was set with FC_SetGlyphCacheLevel().  The font keeps ownership. */
+SDL_Surface* FC_GetGlyphCacheSurface(FC_Font* font, int cache_level);
+
 
 /*! Returns the number of codepoints that are stored in the font's glyph data map. */
 unsigned int FC_GetNumCodepoints(FC_Font* font);
@@ -281,6 +290,15 @@ FC_Rect FC_DrawColumnScale(FC_Font* font, FC_Target* dest, float x, float y, Uin
 FC_Rect FC_DrawColumnColor(FC_Font* font, FC_Target* dest, float x, float y, Uint16 width, SDL_Color color, const char* formatted_text, ...);
 FC_Rect FC_DrawColumnEffect(FC_Font* font, FC_Target* dest, float x, float y, Uint16 width, FC_Effect effect, const char* formatted_text, ...);
 
+/*! Draws the first 'length' bytes of 'text' (up to the terminator if 'length' is negative) like FC_Draw(), but without formatting.  Unlike the variadic functions, it does not go through the shared format buffer, so text of any length is drawn in full and callers on different threads may prepare their strings concurrently.  Drawing itself still has to happen on the render thread. */
+FC_Rect FC_DrawText(FC_Font* font, FC_Target* dest, float x, float y, const char* text, int length);
+
+/*! Draws a rows x cols grid of single-byte characters as a monospace block with one SDL_RenderGeometry() call per glyph cache level instead of one copy per glyph.  Falls back to per-glyph rendering when geometry is not supported (SDL < 2.0.18 or SDL_gpu).  Row r starts at cells + r*pitch.  Glyphs come from a flat 256-entry table filled as glyphs are cached, so there is no UTF-8 decoding or map lookup per cell.  Characters that are not cached (see FC_SetLoadingString()) are drawn as spaces. */
+FC_Rect FC_DrawGrid(FC_Font* font, FC_Target* dest, float x, float y, float line_height, const Uint8* cells, int cols, int rows, int pitch);
+
+/*! Same as FC_DrawGrid(), but each cell is drawn in its own color.  Row r of the colors starts at colors + r*color_pitch.  With geometry support the colors are per-vertex and cost nothing extra; the fallback path changes the cache texture color for every glyph. */
+FC_Rect FC_DrawGridColors(FC_Font* font, FC_Target* dest, float x, float y, float line_height, const Uint8* cells, int cols, int rows, int pitch, const SDL_Color* colors, int color_pitch);
+
 
 // Getters
 
@@ -289,6 +307,9 @@ Uint16 FC_GetLineHeight(FC_Font* font);
 Uint16 FC_GetHeight(FC_Font* font, const char* formatted_text, ...);
 Uint16 FC_GetWidth(FC_Font* font, const char* formatted_text, ...);
 
+/*! Width of the first 'length' bytes of 'text' (up to the terminator if 'length' is negative).  Unformatted counterpart of FC_GetWidth() that does not use the shared format buffer. */
+Uint16 FC_GetTextWidth(FC_Font* font, const char* text, int length);
+
 // Returns a 1-pixel wide box in front of the character in the given position (index)
 FC_Rect FC_GetCharacterOffset(FC_Font* font, Uint16 position_index, int column_width, const char* formatted_text, ...);
 Uint16 FC_GetColumnHeight(FC_Font* font, Uint16 width, const char* formatted_text, ...);
@@ -0,0 +1,133 @@
+#ifndef ASCII_CONVERT_H
+#define ASCII_CONVERT_H
+
+#include <stdint.h>
+
+/**
+ * @brief Sums the luma of consecutive tiles
+ * 
+ * @param src pointer to the top left pixel of the first tile
+ * @param linesize distance between two pixel rows in bytes
+ * @param tiles number of tiles to reduce
+ * @param sums output, one sum (0..255 * tile pixels) per tile
+ */
+typedef void (*TileRowKernel)(const uint8_t* src, int linesize, int tiles, uint16_t* sums);
+
+/**
+ * @brief Picks the fastest tile kernel the running CPU supports (AVX2, SSE2 or scalar)
+ * 
+ * @param tile_w tile width in pixels, 1, 2, 4, 8 or 16
+ * @param tile_h tile height in pixels, 1, 2, 4, 8 or 16
+ * @param name optional output, human readable name of the selected kernel
+ * @return TileRowKernel kernel function or NULL for an unsupported tile size
+ */
+TileRowKernel select_tile_row_kernel(int tile_w, int tile_h, const char** name);
+
+/**
+ * @brief Builds the table mapping a tile luma sum straight to a ramp character
+ * 
+ * @param lut output, 255 * tile_pixels + 1 entries
+ * @param tile_pixels number of pixels summed per tile
+ * @param limited_range true for limited (16-235) luma, false for full range
+ * @param ramp characters ordered from darkest to brightest luma
+ * @param ramp_len number of characters in ramp (at least 2)
+ */
+void build_glyph_lut(char* lut, int tile_pixels, bool limited_range, const char* ramp, int ramp_len);
+
+/**
+ * @brief Converts a row of tile sums to characters
+ * 
+ * @param sums tile sums produced by a TileRowKernel
+ * @param tiles number of tiles
+ * @param lut table built by build_glyph_lut() for the same tile size
+ * @param ascii output, one character per tile
+ */
+void tile_sums_to_ascii(const uint16_t* sums, int tiles, const char* lut, char* ascii);
+
+/* Glyphs for edges running vertically, horizontally, bottom-left to top-right and top-left to bottom-right */
+#define EDGE_GLYPHS "|-/\\"
+
+/**
+ * @brief Converts a row of tiles in one pass over its pixels, accumulating luma and the
+ *          Sobel gradient structure tensor per tile. Tiles with a strong, consistently oriented
+ *          gradient get one of | - / \, the others fall back to the luma ramp
+ * 
+ * @param plane pointer to the top left pixel of the luma plane
+ * @param linesize distance between two pixel rows in bytes
+ * @param plane_height number of pixel rows in the plane, neighbours are clamped to it
+ * @param y first pixel row of the tile row
+ * @param tile_w tile width in pixels
+ * @param tile_h tile height in pixels
+ * @param tiles number of tiles in the row
+ * @param threshold mean Sobel magnitude (0..1140) a tile needs to count as an edge
+ * @param lut table built by build_glyph_lut() for the same tile size
+ * @param columns scratch, 4 * tiles * tile_w entries
+ * @param ascii output, one character per tile
+ */
+void tile_row_edges_to_ascii(const uint8_t* plane, int linesize, int plane_height, int y, int tile_w, int tile_h,
+                             int tiles, int threshold, const char* lut, int32_t* columns, char* ascii);
+
+/* Shape matching splits every tile and glyph cell into 2x2 quadrants, each quantized to 4 bits */
+#define SHAPE_QUADRANTS 4
+#define SHAPE_LEVELS 16
+#define SHAPE_LUT_SIZE (1 << (4 * SHAPE_QUADRANTS))
+
+/* Quadrant ink coverage of the candidate glyphs, one array per quadrant (top left, top right, bottom left, bottom right) */
+typedef struct GlyphCoverage
+{
+    int count;
+    char glyphs[256];
+    uint8_t coverage[SHAPE_QUADRANTS][256];
+}TGlyphCoverage;
+
+/**
+ * @brief Builds the table mapping a quadrant luma sum to its darkness level (0..SHAPE_LEVELS - 1)
+ * 
+ * @param lut output, 255 * quadrant_pixels + 1 entries
+ * @param quadrant_pixels number of pixels summed per quadrant
+ * @param limited_range true for limited (16-235) luma, false for full range
+ */
+void build_quadrant_lut(uint8_t* lut, int quadrant_pixels, bool limited_range);
+
+/**
+ * @brief Builds the table mapping every combination of quadrant darkness levels to
+ *          the glyph whose normalized coverage is nearest (least squares)
+ * 
+ * @param lut output, SHAPE_LUT_SIZE entries
+ * @param glyphs candidate glyph coverage, normalized so full ink is 255
+ */
+void build_shape_lut(char* lut, const TGlyphCoverage* glyphs);
+
+/**
+ * @brief Converts a row of tiles from their quadrant sums
+ * 
+ * @param top sums of the upper quadrants, left and right of each tile interleaved
+ * @param bottom sums of the lower quadrants, same layout
+ * @param tiles number of tiles
+ * @param level_lut table built by build_quadrant_lut() for the same quadrant size
+ * @param shape_lut table built by build_shape_lut()
+ * @param ascii output, one character per tile
+ */
+void quadrants_to_ascii(const uint16_t* top, const uint16_t* bottom, int tiles, const uint8_t* level_lut,
+                        const char* shape_lut, char* ascii);
+
+/**
+ * @brief Converts a row of 8-bit luma samples, one per character, to characters
+ * 
+ * @param luma luma samples already averaged over a tile
+ * @param count number of samples
+ * @param lut table built by build_glyph_lut() with tile_pixels = 1
+ * @param ascii output, one character per sample
+ */
+void luma_to_ascii(const uint8_t* luma, int count, const char* lut, char* ascii);
+
+/**
+ * @brief Scales cell colors so their brightest channel is full intensity, glyph density
+ *          already carries the brightness and dark colors would hide dense glyphs
+ * 
+ * @param rgba colors, 4 bytes (R, G, B, A) per cell, modified in place
+ * @param count number of cells
+ */
+void normalize_cell_colors(uint8_t* rgba, int count);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef MEDIA_INPUT_H
+#define MEDIA_INPUT_H
+
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+extern "C"
+{
+#include <libavformat/avio.h>
+}
+
+/* How the demuxer reads the input file */
+typedef enum InputMode
+{
+    /* Let avformat open the file with its own buffered I/O */
+    INPUT_FILE,
+    /* Map the whole file and copy packets straight from the page cache */
+    INPUT_MMAP,
+    /* Read large aligned chunks ahead of the demuxer on a background thread */
+    INPUT_READAHEAD
+}EInputMode;
+
+/* One chunk of the read ahead ring, [offset, offset + len) of the file */
+typedef struct InputChunk
+{
+    int64_t offset;
+    int len;
+    uint8_t* data;
+}TInputChunk;
+
+/* Custom I/O backing the AVIOContext handed to avformat */
+typedef struct MediaInput
+{
+    EInputMode mode;
+    int fd = -1;
+    int64_t size = 0;
+    /* Position of the next byte the demuxer reads */
+    int64_t pos = 0;
+    AVIOContext* avio = nullptr;
+
+    /* INPUT_MMAP */
+    uint8_t* map = nullptr;
+
+    /* INPUT_READAHEAD: ring of chunks, head is the oldest filled one */
+    TInputChunk* chunks = nullptr;
+    int chunk_count = 0;
+    int chunk_size = 0;
+    int head = 0;
+    int filled = 0;
+    /* File offset the reader thread continues at, restarted when the demuxer seeks outside the ring */
+    int64_t next_offset = 0;
+    unsigned generation = 0;
+    int error = 0;
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread reader;
+}TMediaInput;
+
+/**
+ * @brief Opens a file for custom I/O and creates the AVIOContext to assign to AVFormatContext::pb
+ *
+ * @param input pointer to media input
+ * @param file path of the file, must be a regular file
+ * @param mode INPUT_MMAP or INPUT_READAHEAD
+ * @return int 0 or error code, the caller falls back to INPUT_FILE on error
+ */
+int media_input_open(TMediaInput* input, const char* file, EInputMode mode);
+
+/**
+ * @brief Stops the reader thread, unmaps or closes the file and frees the AVIOContext.
+ *          Call after avformat_close_input, which leaves custom I/O alone
+ *
+ * @param input pointer to media input
+ */
+void media_input_close(TMediaInput* input);
+
+#endif
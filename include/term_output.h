@@ -0,0 +1,53 @@
+#ifndef TERM_OUTPUT_H
+#define TERM_OUTPUT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+/* Writes ASCII frames to a terminal, only sending cells that changed since the previous frame */
+typedef struct TermOutput
+{
+    FILE* stream;
+    int cols;
+    int rows;
+    int visible_cols;
+    int visible_rows;
+    std::vector<char> prev;
+    /* xterm 256 color palette index per cell, only used for colored frames */
+    std::vector<uint8_t> colors;
+    std::vector<uint8_t> prev_colors;
+    std::vector<char> out;
+}TTermOutput;
+
+/**
+ * @brief Prepares the terminal: clears it, hides the cursor and fits the grid to the window size
+ * 
+ * @param term pointer to terminal output
+ * @param stream output stream, usually stdout
+ * @param cols number of character columns of a frame
+ * @param rows number of character rows of a frame
+ * @return int 0 or error code
+ */
+int term_output_init(TTermOutput* term, FILE* stream, int cols, int rows);
+
+/**
+ * @brief Writes the cells that differ from the previous frame as cursor moves followed by characters
+ * 
+ * @param term pointer to terminal output
+ * @param ascii_buffer characters of the frame, row by row
+ * @param rgba optional cell colors, 4 bytes (R, G, B, A) per cell, NULL for monochrome.
+ *          Colors are quantized to the xterm 256 color cube so small changes don't rewrite cells
+ * @param rgba_pitch distance between two rows of colors in bytes
+ * @return size_t number of bytes written
+ */
+size_t term_output_frame(TTermOutput* term, const char* ascii_buffer, const uint8_t* rgba, int rgba_pitch);
+
+/**
+ * @brief Restores the cursor and moves it below the last frame
+ * 
+ * @param term pointer to terminal output
+ */
+void term_output_close(TTermOutput* term);
+
+#endif
@@ -11,6 +11,15 @@ See SDL_FontCache.h for license info.
 #include <stdlib.h>
 #include <string.h>
 
+// Atlas cache files are mapped instead of read where the platform allows it
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define ENABLE_FC_MMAP
+#endif
+
 // Visual C does not support static inline
 #ifndef static_inline
 	#ifdef _MSC_VER
@@ -31,6 +40,11 @@ See SDL_FontCache.h for license info.
     #define ENABLE_SDL_CLIPPING
 #endif
 
+// Need SDL_RenderGeometry() to submit many glyphs at once
+#if !defined(FC_USE_SDL_GPU) && SDL_VERSION_ATLEAST(2,0,18)
+    #define ENABLE_SDL_GEOMETRY
+#endif
+
 #define FC_MIN(a,b) ((a) < (b)? (a) : (b))
 #define FC_MAX(a,b) ((a) > (b)? (a) : (b))
 
@@ -162,6 +176,9 @@ static unsigned int fc_buffer_size = 1024;
 
 static Uint8 fc_has_render_target_support = 0;
 
+// Directory for packed glyph atlases, NULL disables the on-disk cache
+static char* fc_atlas_cache_dir = NULL;
+
 // The number of fonts that has been created but not freed
 static int NUM_EXISTING_FONTS = 0;
 
@@ -278,145 +295,200 @@ FC_GlyphData FC_MakeGlyphData(int cache_level, Sint16 x, Sint16 y, Uint16 w, Uin
     return gd;
 }
 
-// Enough to hold all of the ascii characters and some.
-#define FC_DEFAULT_NUM_BUCKETS 300
+// Codepoints below this are stored in a directly indexed table, everything else in an open-addressing hash table
+#define FC_MAP_DIRECT_SIZE 256
+// Initial number of hash slots, a power of two.  Most fonts only ever cache direct codepoints.
+#define FC_DEFAULT_NUM_BUCKETS 64
+// Glyph values of hashed codepoints are allocated in blocks this large, so pointers to them stay valid when the table grows
+#define FC_MAP_POOL_SIZE 64
 
-typedef struct FC_MapNode
+typedef struct FC_MapSlot
 {
     Uint32 key;
-    FC_GlyphData value;
-    struct FC_MapNode* next;
+    FC_GlyphData* value;  // NULL for an empty slot
+
+} FC_MapSlot;
 
-} FC_MapNode;
+typedef struct FC_MapPool
+{
+    struct FC_MapPool* next;
+    int used;
+    FC_GlyphData values[FC_MAP_POOL_SIZE];
+
+} FC_MapPool;
 
 typedef struct FC_Map
 {
-    int num_buckets;
-    FC_MapNode** buckets;
+    FC_GlyphData direct[FC_MAP_DIRECT_SIZE];
+    Uint8 direct_used[FC_MAP_DIRECT_SIZE];
+
+    int num_buckets;  // Always a power of two, at least 2
+    int hash_shift;  // 32 - log2(num_buckets)
+    int num_used;  // Occupied hash slots
+    FC_MapSlot* buckets;
+    FC_MapPool* pool;
 } FC_Map;
 
 
 
-static FC_Map* FC_MapCreate(int num_buckets)
+// Fibonacci hashing spreads codepoints over the table.  The top bits of the product depend on every bit of the codepoint, the low bits only on the low ones.
+static_inline Uint32 FC_MapHash(FC_Map* map, Uint32 codepoint)
 {
-    int i;
-    FC_Map* map = (FC_Map*)malloc(sizeof(FC_Map));
+    return (Uint32)(codepoint * 2654435769u) >> map->hash_shift;
+}
 
-    map->num_buckets = num_buckets;
-    map->buckets = (FC_MapNode**)malloc(num_buckets * sizeof(FC_MapNode*));
+static FC_Map* FC_MapCreate(int num_buckets)
+{
+    FC_Map* map = (FC_Map*)calloc(1, sizeof(FC_Map));
 
-    for(i = 0; i < num_buckets; ++i)
+    map->num_buckets = 2;
+    map->hash_shift = 31;
+    while(map->num_buckets < num_buckets)
     {
-        map->buckets[i] = NULL;
+        map->num_buckets *= 2;
+        map->hash_shift--;
     }
+    map->buckets = (FC_MapSlot*)calloc(map->num_buckets, sizeof(FC_MapSlot));
 
     return map;
 }
 
-/*static void FC_MapClear(FC_Map* map)
+static void FC_MapFree(FC_Map* map)
 {
-    int i;
     if(map == NULL)
         return;
 
-    // Go through each bucket
-    for(i = 0; i < map->num_buckets; ++i)
+    while(map->pool != NULL)
     {
-        // Delete the nodes in order
-        FC_MapNode* node = map->buckets[i];
-        while(node != NULL)
-        {
-            FC_MapNode* last = node;
-            node = node->next;
-            free(last);
-        }
-        // Set the bucket to empty
-        map->buckets[i] = NULL;
+        FC_MapPool* last = map->pool;
+        map->pool = map->pool->next;
+        free(last);
     }
-}*/
 
-static void FC_MapFree(FC_Map* map)
+    free(map->buckets);
+    free(map);
+}
+
+static FC_GlyphData* FC_MapAllocValue(FC_Map* map)
+{
+    if(map->pool == NULL || map->pool->used == FC_MAP_POOL_SIZE)
+    {
+        FC_MapPool* pool = (FC_MapPool*)malloc(sizeof(FC_MapPool));
+        pool->next = map->pool;
+        pool->used = 0;
+        map->pool = pool;
+    }
+
+    return &map->pool->values[map->pool->used++];
+}
+
+// Doubles the hash table.  Values live in the pool, so only the slots move.
+static void FC_MapGrow(FC_Map* map)
 {
     int i;
-    if(map == NULL)
-        return;
+    FC_MapSlot* old_buckets = map->buckets;
+    int old_num_buckets = map->num_buckets;
 
-    // Go through each bucket
-    for(i = 0; i < map->num_buckets; ++i)
+    map->num_buckets *= 2;
+    map->hash_shift--;
+    map->buckets = (FC_MapSlot*)calloc(map->num_buckets, sizeof(FC_MapSlot));
+
+    for(i = 0; i < old_num_buckets; ++i)
     {
-        // Delete the nodes in order
-        FC_MapNode* node = map->buckets[i];
-        while(node != NULL)
-        {
-            FC_MapNode* last = node;
-            node = node->next;
-            free(last);
-        }
+        Uint32 index;
+        if(old_buckets[i].value == NULL)
+            continue;
+
+        for(index = FC_MapHash(map, old_buckets[i].key); map->buckets[index].value != NULL; index = (index + 1) & (map->num_buckets - 1))
+            ;
+        map->buckets[index] = old_buckets[i];
     }
 
-    free(map->buckets);
-    free(map);
+    free(old_buckets);
 }
 
-// Note: Does not handle duplicates in any special way.
+// Replaces the value of a codepoint that is already present
 static FC_GlyphData* FC_MapInsert(FC_Map* map, Uint32 codepoint, FC_GlyphData glyph)
 {
     Uint32 index;
-    FC_MapNode* node;
     if(map == NULL)
         return NULL;
 
-    // Get index for bucket
-    index = codepoint % map->num_buckets;
-
-    // If this bucket is empty, create a node and return its value
-    if(map->buckets[index] == NULL)
+    if(codepoint < FC_MAP_DIRECT_SIZE)
     {
-        node = map->buckets[index] = (FC_MapNode*)malloc(sizeof(FC_MapNode));
-        node->key = codepoint;
-        node->value = glyph;
-        node->next = NULL;
-        return &node->value;
+        map->direct[codepoint] = glyph;
+        map->direct_used[codepoint] = 1;
+        return &map->direct[codepoint];
     }
 
-    for(node = map->buckets[index]; node != NULL; node = node->next)
+    // Keep the load factor at or below one half so probe sequences stay short
+    if(2 * (map->num_used + 1) > map->num_buckets)
+        FC_MapGrow(map);
+
+    // Linear probing
+    for(index = FC_MapHash(map, codepoint); map->buckets[index].value != NULL; index = (index + 1) & (map->num_buckets - 1))
     {
-        // Find empty node and add a new one on.
-        if(node->next == NULL)
+        if(map->buckets[index].key == codepoint)
         {
-            node->next = (FC_MapNode*)malloc(sizeof(FC_MapNode));
-            node = node->next;
-
-            node->key = codepoint;
-            node->value = glyph;
-            node->next = NULL;
-            return &node->value;
+            *map->buckets[index].value = glyph;
+            return map->buckets[index].value;
         }
     }
 
-    return NULL;
+    map->buckets[index].key = codepoint;
+    map->buckets[index].value = FC_MapAllocValue(map);
+    *map->buckets[index].value = glyph;
+    map->num_used++;
+    return map->buckets[index].value;
 }
 
 static FC_GlyphData* FC_MapFind(FC_Map* map, Uint32 codepoint)
 {
     Uint32 index;
-    FC_MapNode* node;
     if(map == NULL)
         return NULL;
 
-    // Get index for bucket
-    index = codepoint % map->num_buckets;
+    if(codepoint < FC_MAP_DIRECT_SIZE)
+        return map->direct_used[codepoint]? &map->direct[codepoint] : NULL;
 
-    // Go through list until we find a match
-    for(node = map->buckets[index]; node != NULL; node = node->next)
+    for(index = FC_MapHash(map, codepoint); map->buckets[index].value != NULL; index = (index + 1) & (map->num_buckets - 1))
     {
-        if(node->key == codepoint)
-            return &node->value;
+        if(map->buckets[index].key == codepoint)
+            return map->buckets[index].value;
     }
 
     return NULL;
 }
 
+// Visits every stored codepoint, direct ones first in ascending order
+static unsigned int FC_MapGetKeys(FC_Map* map, Uint32* result)
+{
+    int i;
+    unsigned int count = 0;
+
+    for(i = 0; i < FC_MAP_DIRECT_SIZE; ++i)
+    {
+        if(map->direct_used[i])
+        {
+            if(result != NULL)
+                result[count] = i;
+            count++;
+        }
+    }
+
+    for(i = 0; i < map->num_buckets; ++i)
+    {
+        if(map->buckets[i].value != NULL)
+        {
+            if(result != NULL)
+                result[count] = map->buckets[i].key;
+            count++;
+        }
+    }
+
+    return count;
+}
+
 
 
 struct FC_Font
@@ -449,11 +521,44 @@ struct FC_Font
     int glyph_cache_size;
     int glyph_cache_count;
     FC_Image** glyph_cache;
+    SDL_Surface** glyph_cache_surfaces;  // CPU copies of the cache levels, NULL where a level was set from outside
 
     char* loading_string;
 
+    // Identifies the font file, size, style and loading string for the on-disk atlas cache, 0 when not cacheable
+    Uint64 atlas_key;
+
+    // Font file the current load came from, lets worker threads open their own TTF_Font.  NULL when not loading from a file.
+    const char* raster_filename;
+    Uint32 raster_point_size;
+    int raster_style;
+
+    // Glyphs for single-byte characters indexed by byte, used by grid drawing to skip UTF-8 decoding and map lookups
+    // Blank or unavailable characters have a cache_level of -1 and only keep their width
+    FC_GlyphData grid_glyphs[256];
+
+    #ifdef ENABLE_SDL_GEOMETRY
+    // Reused by batched drawing: 4 vertices and 6 indices per glyph quad
+    SDL_Vertex* batch_vertices;
+    int* batch_indices;
+    int batch_capacity;
+    #endif
+
 };
 
+// Keeps the flat grid table in sync with the glyph map for single-byte codepoints
+static void FC_UpdateGridGlyph(FC_Font* font, Uint32 codepoint, FC_GlyphData* glyph)
+{
+    FC_GlyphData* entry;
+    if(codepoint > 0x7F || glyph == NULL)
+        return;
+
+    entry = &font->grid_glyphs[codepoint];
+    *entry = *glyph;
+    if(codepoint == ' ' || codepoint == '\t')
+        entry->cache_level = -1;
+}
+
 // Private
 static FC_GlyphData* FC_PackGlyphData(FC_Font* font, Uint32 codepoint, Uint16 width, Uint16 maxWidth, Uint16 maxHeight);
 
@@ -473,6 +578,19 @@ static_inline SDL_Surface* FC_CreateSurface32(Uint32 width, Uint32 height)
 }
 
 
+static void FC_FreeGlyphCacheSurfaces(FC_Font* font)
+{
+    int i;
+    if(font->glyph_cache_surfaces == NULL)
+        return;
+
+    for(i = 0; i < font->glyph_cache_count; ++i)
+        SDL_FreeSurface(font->glyph_cache_surfaces[i]);
+    free(font->glyph_cache_surfaces);
+    font->glyph_cache_surfaces = NULL;
+}
+
+
 char* U8_alloc(unsigned int size)
 {
     char* result;
@@ -834,6 +952,19 @@ void FC_SetBufferSize(unsigned int size)
 }
 
 
+const char* FC_GetAtlasCacheDir(void)
+{
+    return fc_atlas_cache_dir;
+}
+
+void FC_SetAtlasCacheDir(const char* directory)
+{
+    free(fc_atlas_cache_dir);
+    fc_atlas_cache_dir = NULL;
+    if(directory != NULL)
+        fc_atlas_cache_dir = U8_strdup(directory);
+}
+
 unsigned int FC_GetTabWidth(void)
 {
     return fc_tab_width;
@@ -852,6 +983,7 @@ void FC_SetTabWidth(unsigned int width_in_spaces)
 
 static void FC_Init(FC_Font* font)
 {
+    int i;
     if(font == NULL)
         return;
 
@@ -894,8 +1026,13 @@ static void FC_Init(FC_Font* font)
     font->glyph_cache_size = 3;
     font->glyph_cache_count = 0;
 
+    memset(font->grid_glyphs, 0, sizeof(font->grid_glyphs));
+    for(i = 0; i < 256; ++i)
+        font->grid_glyphs[i].cache_level = -1;
+
 
     font->glyph_cache = (FC_Image**)malloc(font->glyph_cache_size * sizeof(FC_Image*));
+    font->glyph_cache_surfaces = (SDL_Surface**)calloc(font->glyph_cache_size, sizeof(SDL_Surface*));
 
 	if (font->loading_string == NULL)
 		font->loading_string = FC_GetStringASCII();
@@ -924,6 +1061,7 @@ static Uint8 FC_GrowGlyphCache(FC_Font* font)
         #endif
         return 0;
     }
+    font->glyph_cache_surfaces[font->glyph_cache_count-1] = FC_CreateSurface32(font->height * 12, font->height * 12);
     // bug: we do not have the correct color here, this might be the wrong color!
     //      , most functions use set_color_for_all_caches()
     //   - for evading this bug, you must use FC_SetDefaultColor(), before using any draw functions
@@ -1061,6 +1199,7 @@ Uint8 FC_UploadGlyphCache(FC_Font* font, int cache_level, SDL_Surface* data_surf
         #endif
         return 0;
     }
+    font->glyph_cache_surfaces[cache_level] = SDL_ConvertSurface(data_surface, data_surface->format, 0);
     return 1;
 }
 
@@ -1102,7 +1241,11 @@ static FC_GlyphData* FC_PackGlyphData(FC_Font* font, Uint32 codepoint, Uint16 wi
     last_glyph->rect.x += last_glyph->rect.w + 1 + FC_CACHE_PADDING;
     last_glyph->rect.w = width;
 
-    return FC_MapInsert(glyphs, codepoint, FC_MakeGlyphData(last_glyph->cache_level, last_glyph->rect.x, last_glyph->rect.y, last_glyph->rect.w, last_glyph->rect.h));
+    {
+        FC_GlyphData* glyph = FC_MapInsert(glyphs, codepoint, FC_MakeGlyphData(last_glyph->cache_level, last_glyph->rect.x, last_glyph->rect.y, last_glyph->rect.w, last_glyph->rect.h));
+        FC_UpdateGridGlyph(font, codepoint, glyph);
+        return glyph;
+    }
 }
 
 
@@ -1114,6 +1257,14 @@ FC_Image* FC_GetGlyphCacheLevel(FC_Font* font, int cache_level)
     return font->glyph_cache[cache_level];
 }
 
+SDL_Surface* FC_GetGlyphCacheSurface(FC_Font* font, int cache_level)
+{
+    if(font == NULL || font->glyph_cache_surfaces == NULL || cache_level < 0 || cache_level >= font->glyph_cache_count)
+        return NULL;
+
+    return font->glyph_cache_surfaces[cache_level];
+}
+
 Uint8 FC_SetGlyphCacheLevel(FC_Font* font, int cache_level, FC_Image* cache_texture)
 {
     if(font == NULL || cache_level < 0)
@@ -1133,15 +1284,29 @@ Uint8 FC_SetGlyphCacheLevel(FC_Font* font, int cache_level, FC_Image* cache_text
             // Copy old cache to new one
             int i;
             FC_Image** new_cache;
+            SDL_Surface** new_surfaces;
             new_cache = (FC_Image**)malloc(font->glyph_cache_count * sizeof(FC_Image*));
+            new_surfaces = (SDL_Surface**)calloc(font->glyph_cache_count, sizeof(SDL_Surface*));
             for(i = 0; i < font->glyph_cache_size; ++i)
+            {
                 new_cache[i] = font->glyph_cache[i];
+                new_surfaces[i] = font->glyph_cache_surfaces[i];
+            }
 
             // Save new cache
             free(font->glyph_cache);
+            free(font->glyph_cache_surfaces);
             font->glyph_cache_size = font->glyph_cache_count;
             font->glyph_cache = new_cache;
+            font->glyph_cache_surfaces = new_surfaces;
         }
+        font->glyph_cache_surfaces[cache_level] = NULL;
+    }
+    else
+    {
+        // The CPU copy no longer matches a texture set from outside
+        SDL_FreeSurface(font->glyph_cache_surfaces[cache_level]);
+        font->glyph_cache_surfaces[cache_level] = NULL;
     }
 
     font->glyph_cache[cache_level] = cache_texture;
@@ -1163,15 +1328,452 @@ FC_Font* FC_CreateFont(void)
 }
 
 
+// On-disk glyph atlas cache
+// Layout: FC_AtlasHeader, num_glyphs FC_AtlasGlyph entries, then per cache level an FC_AtlasLevel followed by h rows of w*4 bytes.
+// Everything is stored in native byte order, the header rejects files written by a different layout.
+
+#define FC_ATLAS_MAGIC 0x54414346  // "FCAT"
+#define FC_ATLAS_VERSION 1
+#define FC_FNV_OFFSET 0xcbf29ce484222325ULL
+#define FC_FNV_PRIME 0x100000001b3ULL
+
+typedef struct FC_AtlasHeader
+{
+    Uint32 magic;
+    Uint32 version;
+    Uint64 key;
+    Uint32 glyph_data_size;
+    Uint32 num_glyphs;
+    Uint32 num_levels;
+    Sint32 height;
+    Sint32 ascent;
+    Sint32 descent;
+    FC_GlyphData last_glyph;
+} FC_AtlasHeader;
+
+typedef struct FC_AtlasGlyph
+{
+    Uint32 codepoint;
+    FC_GlyphData data;
+} FC_AtlasGlyph;
+
+typedef struct FC_AtlasLevel
+{
+    Uint32 w;
+    Uint32 h;
+    Uint32 format;
+} FC_AtlasLevel;
+
+static Uint64 FC_HashBytes(Uint64 hash, const void* data, size_t size)
+{
+    const Uint8* bytes = (const Uint8*)data;
+    size_t i;
+    for(i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= FC_FNV_PRIME;
+    }
+    return hash;
+}
+
+// Hashes the font file contents together with everything else that changes the rasterized glyphs
+static Uint64 FC_MakeAtlasKey(const char* filename_ttf, Uint32 pointSize, int style, const char* loading_string)
+{
+    Uint8 chunk[16384];
+    size_t len;
+    Uint64 hash = FC_FNV_OFFSET;
+    SDL_RWops* rwops = SDL_RWFromFile(filename_ttf, "rb");
+    if(rwops == NULL)
+        return 0;
+
+    while((len = SDL_RWread(rwops, chunk, 1, sizeof(chunk))) > 0)
+        hash = FC_HashBytes(hash, chunk, len);
+    SDL_RWclose(rwops);
+
+    hash = FC_HashBytes(hash, &pointSize, sizeof(pointSize));
+    hash = FC_HashBytes(hash, &style, sizeof(style));
+    hash = FC_HashBytes(hash, loading_string, strlen(loading_string));
+
+    // A library upgrade may rasterize differently, so old bitmaps must not match
+    {
+        const SDL_version* ttf_version = TTF_Linked_Version();
+        int ft_version[3] = {0, 0, 0};
+        hash = FC_HashBytes(hash, &ttf_version->major, sizeof(ttf_version->major));
+        hash = FC_HashBytes(hash, &ttf_version->minor, sizeof(ttf_version->minor));
+        hash = FC_HashBytes(hash, &ttf_version->patch, sizeof(ttf_version->patch));
+        #if SDL_TTF_VERSION_ATLEAST(2,0,18)
+        TTF_GetFreeTypeVersion(&ft_version[0], &ft_version[1], &ft_version[2]);
+        #endif
+        hash = FC_HashBytes(hash, ft_version, sizeof(ft_version));
+    }
+
+    // 0 means "no key"
+    return (hash == 0)? 1 : hash;
+}
+
+static void FC_GetAtlasCachePath(char* path, int size, Uint64 key)
+{
+    snprintf(path, size, "%s/fc_%016llx.atlas", fc_atlas_cache_dir, (unsigned long long)key);
+}
+
+// Maps (or reads, where mapping is unavailable) a whole file.  Returns NULL on failure.
+static void* FC_MapFile(const char* path, size_t* size)
+{
+    #ifdef ENABLE_FC_MMAP
+    struct stat st;
+    void* data;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    if(fstat(fd, &st) < 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return NULL;
+    *size = st.st_size;
+    return data;
+    #else
+    return SDL_LoadFile(path, size);
+    #endif
+}
+
+static void FC_UnmapFile(void* data, size_t size)
+{
+    #ifdef ENABLE_FC_MMAP
+    munmap(data, size);
+    #else
+    (void)size;
+    SDL_free(data);
+    #endif
+}
+
+// Drops all cached glyphs and cache levels but keeps the font metrics, so the glyphs can be rasterized again
+static void FC_DiscardGlyphs(FC_Font* font)
+{
+    int i;
+    for(i = 0; i < font->glyph_cache_count; ++i)
+    {
+        #ifdef FC_USE_SDL_GPU
+        GPU_FreeImage(font->glyph_cache[i]);
+        #else
+        SDL_DestroyTexture(font->glyph_cache[i]);
+        #endif
+        SDL_FreeSurface(font->glyph_cache_surfaces[i]);
+        font->glyph_cache_surfaces[i] = NULL;
+    }
+    font->glyph_cache_count = 0;
+
+    FC_MapFree(font->glyphs);
+    font->glyphs = FC_MapCreate(FC_DEFAULT_NUM_BUCKETS);
+    memset(font->grid_glyphs, 0, sizeof(font->grid_glyphs));
+    for(i = 0; i < 256; ++i)
+        font->grid_glyphs[i].cache_level = -1;
+}
+
+static Uint8 FC_IsAtlasGlyphValid(const FC_GlyphData* glyph, const FC_AtlasLevel* levels, Uint32 num_levels)
+{
+    const SDL_Rect* r = &glyph->rect;
+    if(glyph->cache_level < 0 || (Uint32)glyph->cache_level >= num_levels)
+        return 0;
+    return (r->x >= 0 && r->y >= 0 && r->w >= 0 && r->h >= 0
+            && (Uint32)r->x + (Uint32)r->w <= levels[glyph->cache_level].w
+            && (Uint32)r->y + (Uint32)r->h <= levels[glyph->cache_level].h);
+}
+
+// Restores the glyph map and cache levels from a previously saved atlas.  Returns 0 if there is no usable cache file.
+static Uint8 FC_LoadAtlasCache(FC_Font* font, Uint64 key)
+{
+    char path[1024];
+    size_t size = 0;
+    size_t offset;
+    const Uint8* data;
+    FC_AtlasHeader header;
+    FC_AtlasLevel* levels;
+    Uint8 valid;
+    Uint32 i;
+
+    FC_GetAtlasCachePath(path, sizeof(path), key);
+    data = (const Uint8*)FC_MapFile(path, &size);
+    if(data == NULL)
+        return 0;
+
+    if(size < sizeof(header))
+    {
+        FC_UnmapFile((void*)data, size);
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    offset = sizeof(header);
+
+    // The metrics come from the TTF_Font, so a matching file also has to agree with them
+    if(header.magic != FC_ATLAS_MAGIC || header.version != FC_ATLAS_VERSION || header.key != key
+       || header.glyph_data_size != sizeof(FC_GlyphData) || header.num_levels == 0
+       || header.height != font->height || header.ascent != font->ascent || header.descent != font->descent
+       || (size - offset) / sizeof(FC_AtlasGlyph) < header.num_glyphs
+       || (size - offset) / sizeof(FC_AtlasLevel) < header.num_levels)
+    {
+        FC_UnmapFile((void*)data, size);
+        return 0;
+    }
+
+    // Check the level sizes before touching the font
+    levels = (FC_AtlasLevel*)malloc(header.num_levels * sizeof(FC_AtlasLevel));
+    if(levels == NULL)
+    {
+        FC_UnmapFile((void*)data, size);
+        return 0;
+    }
+    {
+        size_t level_offset = offset + header.num_glyphs * sizeof(FC_AtlasGlyph);
+        for(i = 0; i < header.num_levels; ++i)
+        {
+            FC_AtlasLevel* level = &levels[i];
+            if(size - level_offset < sizeof(*level))
+                break;
+            memcpy(level, data + level_offset, sizeof(*level));
+            level_offset += sizeof(*level);
+            if(level->w == 0 || level->h == 0 || (size - level_offset) / 4 / level->w < level->h)
+                break;
+            level_offset += (size_t)level->w * level->h * 4;
+        }
+        valid = (i == header.num_levels);
+    }
+
+    // Every glyph, including the one new glyphs are packed after, has to lie inside its level.  Stale or corrupt records would be drawn from outside the atlas.
+    valid = valid && FC_IsAtlasGlyphValid(&header.last_glyph, levels, header.num_levels);
+    for(i = 0; valid && i < header.num_glyphs; ++i)
+    {
+        FC_AtlasGlyph entry;
+        memcpy(&entry, data + offset + i * sizeof(entry), sizeof(entry));
+        valid = FC_IsAtlasGlyphValid(&entry.data, levels, header.num_levels);
+    }
+    free(levels);
+    if(!valid)
+    {
+        FC_UnmapFile((void*)data, size);
+        return 0;
+    }
+
+    for(i = 0; i < header.num_glyphs; ++i)
+    {
+        FC_AtlasGlyph entry;
+        memcpy(&entry, data + offset, sizeof(entry));
+        offset += sizeof(entry);
+        FC_UpdateGridGlyph(font, entry.codepoint, FC_MapInsert(font->glyphs, entry.codepoint, entry.data));
+    }
+
+    // One texture upload per level straight from the mapped pixels
+    for(i = 0; i < header.num_levels; ++i)
+    {
+        FC_AtlasLevel level;
+        SDL_Surface* surface;
+        memcpy(&level, data + offset, sizeof(level));
+        offset += sizeof(level);
+
+        surface = SDL_CreateRGBSurfaceWithFormatFrom((void*)(data + offset), level.w, level.h, 32, level.w * 4, level.format);
+        offset += (size_t)level.w * level.h * 4;
+        if(surface == NULL || !FC_UploadGlyphCache(font, i, surface))
+        {
+            SDL_FreeSurface(surface);
+            FC_UnmapFile((void*)data, size);
+            FC_DiscardGlyphs(font);
+            return 0;
+        }
+        SDL_FreeSurface(surface);
+        #ifndef FC_USE_SDL_GPU
+        SDL_SetTextureBlendMode(font->glyph_cache[i], SDL_BLENDMODE_BLEND);
+        #endif
+    }
+
+    font->last_glyph = header.last_glyph;
+    FC_UnmapFile((void*)data, size);
+    return 1;
+}
+
+// Creates a temporary file next to path that no other process writes to.  Several instances may save the same atlas at once.
+static FILE* FC_CreateTempFile(const char* path, char* temp_path, size_t temp_path_size)
+{
+    #ifdef ENABLE_FC_MMAP
+    int fd;
+    FILE* file;
+    snprintf(temp_path, temp_path_size, "%s.XXXXXX", path);
+    fd = mkstemp(temp_path);
+    if(fd < 0)
+        return NULL;
+    file = fdopen(fd, "wb");
+    if(file == NULL)
+    {
+        close(fd);
+        remove(temp_path);
+    }
+    return file;
+    #else
+    // Exclusive creation, if another instance is writing the atlas it is left to that one
+    snprintf(temp_path, temp_path_size, "%s.tmp", path);
+    return fopen(temp_path, "wbx");
+    #endif
+}
+
+// Writes the glyph map and the CPU copies of all cache levels.  Written to a temporary file first so readers never see a partial atlas.
+static void FC_SaveAtlasCache(FC_Font* font, Uint64 key)
+{
+    char path[1024];
+    char temp_path[1040];
+    FILE* file;
+    FC_AtlasHeader header;
+    Uint32* codepoints;
+    Uint8 ok = 1;
+    int i;
+
+    // Levels set from outside have no CPU copy to save
+    for(i = 0; i < font->glyph_cache_count; ++i)
+    {
+        if(FC_GetGlyphCacheSurface(font, i) == NULL)
+            return;
+    }
+
+    FC_GetAtlasCachePath(path, sizeof(path), key);
+    file = FC_CreateTempFile(path, temp_path, sizeof(temp_path));
+    if(file == NULL)
+        return;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = FC_ATLAS_MAGIC;
+    header.version = FC_ATLAS_VERSION;
+    header.key = key;
+    header.glyph_data_size = sizeof(FC_GlyphData);
+    header.num_glyphs = FC_GetNumCodepoints(font);
+    header.num_levels = font->glyph_cache_count;
+    header.height = font->height;
+    header.ascent = font->ascent;
+    header.descent = font->descent;
+    header.last_glyph = font->last_glyph;
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+
+    codepoints = (Uint32*)malloc(header.num_glyphs * sizeof(Uint32) + 1);
+    FC_GetCodepoints(font, codepoints);
+    for(i = 0; ok && i < (int)header.num_glyphs; ++i)
+    {
+        FC_AtlasGlyph entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.codepoint = codepoints[i];
+        FC_GetGlyphData(font, &entry.data, codepoints[i]);
+        ok = fwrite(&entry, sizeof(entry), 1, file) == 1;
+    }
+    free(codepoints);
+
+    for(i = 0; ok && i < font->glyph_cache_count; ++i)
+    {
+        SDL_Surface* surface = FC_GetGlyphCacheSurface(font, i);
+        FC_AtlasLevel level;
+        int y;
+        level.w = surface->w;
+        level.h = surface->h;
+        level.format = surface->format->format;
+        ok = (surface->format->BytesPerPixel == 4) && fwrite(&level, sizeof(level), 1, file) == 1;
+        for(y = 0; ok && y < surface->h; ++y)
+            ok = fwrite((Uint8*)surface->pixels + y*surface->pitch, (size_t)surface->w * 4, 1, file) == 1;
+    }
+
+    ok = (fclose(file) == 0) && ok;
+    if(!ok || rename(temp_path, path) != 0)
+    {
+        FC_Log("SDL_FontCache: Could not write glyph atlas cache %s\n", path);
+        remove(temp_path);
+    }
+}
+
+
 // Assume this many will be enough...
 #define FC_LOAD_MAX_SURFACES 10
 
+// Rasterizing is split across threads only if every thread gets at least this many glyphs
+#define FC_RASTER_MIN_GLYPHS_PER_THREAD 16
+#define FC_RASTER_MAX_THREADS 8
+
+// Renders every step-th glyph of the loading string starting at first.  A TTF_Font must only be used by one thread.
+typedef struct FC_RasterJob
+{
+    TTF_Font* ttf;
+    char (*chars)[5];
+    SDL_Surface** surfaces;
+    int count;
+    int first;
+    int step;
+} FC_RasterJob;
+
+static int FC_RasterizeGlyphs(void* data)
+{
+    FC_RasterJob* job = (FC_RasterJob*)data;
+    SDL_Color white = {255, 255, 255, 255};
+    int i;
+    for(i = job->first; i < job->count; i += job->step)
+        job->surfaces[i] = TTF_RenderUTF8_Blended(job->ttf, job->chars[i], white);
+    return 0;
+}
+
+// Renders all glyphs into separate surfaces.  With a font file to open, extra threads each render a share with their own TTF_Font.
+static void FC_RasterizeLoadingString(FC_Font* font, TTF_Font* ttf, char (*chars)[5], SDL_Surface** surfaces, int count)
+{
+    FC_RasterJob jobs[FC_RASTER_MAX_THREADS];
+    SDL_Thread* threads[FC_RASTER_MAX_THREADS];
+    int num_jobs = 1;
+    int i;
+
+    if(font->raster_filename != NULL)
+    {
+        num_jobs = FC_MIN(FC_MIN(SDL_GetCPUCount(), FC_RASTER_MAX_THREADS), count / FC_RASTER_MIN_GLYPHS_PER_THREAD);
+        num_jobs = FC_MAX(num_jobs, 1);
+    }
+
+    // Fonts are opened and closed on this thread, SDL_ttf shares one FreeType library between them
+    jobs[0].ttf = ttf;
+    for(i = 1; i < num_jobs; ++i)
+    {
+        jobs[i].ttf = TTF_OpenFont(font->raster_filename, font->raster_point_size);
+        if(jobs[i].ttf == NULL)
+            break;
+        if(font->raster_style & TTF_STYLE_OUTLINE)
+            TTF_SetFontOutline(jobs[i].ttf, 1);
+        TTF_SetFontStyle(jobs[i].ttf, font->raster_style & ~TTF_STYLE_OUTLINE);
+    }
+    num_jobs = i;
+
+    for(i = 0; i < num_jobs; ++i)
+    {
+        jobs[i].chars = chars;
+        jobs[i].surfaces = surfaces;
+        jobs[i].count = count;
+        jobs[i].first = i;
+        jobs[i].step = num_jobs;
+    }
+
+    for(i = 1; i < num_jobs; ++i)
+        threads[i] = SDL_CreateThread(FC_RasterizeGlyphs, "FC_Rasterize", &jobs[i]);
+    FC_RasterizeGlyphs(&jobs[0]);
+
+    for(i = 1; i < num_jobs; ++i)
+    {
+        // A thread that could not start leaves its share to us
+        if(threads[i] != NULL)
+            SDL_WaitThread(threads[i], NULL);
+        else
+            FC_RasterizeGlyphs(&jobs[i]);
+        TTF_CloseFont(jobs[i].ttf);
+    }
+}
+
 #ifdef FC_USE_SDL_GPU
 Uint8 FC_LoadFontFromTTF(FC_Font* font, TTF_Font* ttf, SDL_Color color)
 #else
 Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, SDL_Color color)
 #endif
 {
+    Uint64 atlas_key;
     if(font == NULL || ttf == NULL)
         return 0;
     #ifndef FC_USE_SDL_GPU
@@ -1179,6 +1781,10 @@ Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, S
         return 0;
     #endif
 
+    // The key and font file only apply to the load they were set for
+    atlas_key = font->atlas_key;
+    font->atlas_key = 0;
+
     FC_ClearFont(font);
 
 
@@ -1208,13 +1814,19 @@ Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, S
 
     font->default_color = color;
 
+    // A cached atlas skips rasterizing and packing the loading string
+    if(atlas_key != 0 && FC_LoadAtlasCache(font, atlas_key))
+        return 1;
+
     {
-        SDL_Color white = {255, 255, 255, 255};
         SDL_Surface* glyph_surf;
-        char buff[5];
-        const char* buff_ptr = buff;
+        const char* buff_ptr;
         const char* source_string;
         Uint8 packed = 0;
+        int num_chars = 0;
+        int c;
+        char (*chars)[5];
+        SDL_Surface** glyph_surfs;
 
         // Copy glyphs from the surface to the font texture and store the position data
         // Pack row by row into a square texture
@@ -1229,13 +1841,21 @@ Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, S
         font->last_glyph.rect.w = 0;
         font->last_glyph.rect.h = font->height;
 
-        source_string = font->loading_string;
-        for(; *source_string != '\0'; source_string = U8_next(source_string))
+        // Split the loading string into characters and render them all up front
+        chars = (char (*)[5])calloc(U8_strlen(font->loading_string) + 1, 5);
+        for(source_string = font->loading_string; *source_string != '\0'; source_string = U8_next(source_string))
         {
-            memset(buff, 0, 5);
-            if(!U8_charcpy(buff, source_string, 5))
-                continue;
-            glyph_surf = TTF_RenderUTF8_Blended(ttf, buff, white);
+            if(U8_charcpy(chars[num_chars], source_string, 5))
+                num_chars++;
+        }
+        glyph_surfs = (SDL_Surface**)calloc(num_chars + 1, sizeof(SDL_Surface*));
+        FC_RasterizeLoadingString(font, ttf, chars, glyph_surfs, num_chars);
+
+        for(c = 0; c < num_chars; ++c)
+        {
+            buff_ptr = chars[c];
+            glyph_surf = glyph_surfs[c];
+            glyph_surfs[c] = NULL;
             if(glyph_surf == NULL)
                 continue;
 
@@ -1278,6 +1898,12 @@ Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, S
             SDL_FreeSurface(glyph_surf);
         }
 
+        // Glyphs left over when the cache levels ran out
+        for(; c < num_chars; ++c)
+            SDL_FreeSurface(glyph_surfs[c]);
+        free(glyph_surfs);
+        free(chars);
+
         {
             int i = num_surfaces-1;
             FC_UploadGlyphCache(font, i, surfaces[i]);
@@ -1288,6 +1914,9 @@ Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, S
         }
     }
 
+    if(atlas_key != 0)
+        FC_SaveAtlasCache(font, atlas_key);
+
     return 1;
 }
 
@@ -1299,6 +1928,7 @@ Uint8 FC_LoadFont(FC_Font* font, FC_Target* renderer, const char* filename_ttf,
 #endif
 {
     SDL_RWops* rwops;
+    Uint8 result;
 
     if(font == NULL)
         return 0;
@@ -1311,11 +1941,23 @@ Uint8 FC_LoadFont(FC_Font* font, FC_Target* renderer, const char* filename_ttf,
         return 0;
     }
 
+    // Only fonts loaded from a file can be identified for the atlas cache or opened again by rasterizing threads
+    if(fc_atlas_cache_dir != NULL)
+        font->atlas_key = FC_MakeAtlasKey(filename_ttf, pointSize, style, font->loading_string);
+    font->raster_filename = filename_ttf;
+    font->raster_point_size = pointSize;
+    font->raster_style = style;
+
     #ifdef FC_USE_SDL_GPU
-    return FC_LoadFont_RW(font, rwops, 1, pointSize, color, style);
+    result = FC_LoadFont_RW(font, rwops, 1, pointSize, color, style);
     #else
-    return FC_LoadFont_RW(font, renderer, rwops, 1, pointSize, color, style);
+    result = FC_LoadFont_RW(font, renderer, rwops, 1, pointSize, color, style);
     #endif
+
+    // Unused if loading failed before the glyphs
+    font->atlas_key = 0;
+    font->raster_filename = NULL;
+    return result;
 }
 
 #ifdef FC_USE_SDL_GPU
@@ -1391,6 +2033,7 @@ void FC_ResetFontFromRendererReset(FC_Font* font, SDL_Renderer* renderer, Uint32
             SDL_DestroyTexture(font->glyph_cache[i]);
     }
     free(font->glyph_cache);
+    FC_FreeGlyphCacheSurfaces(font);
 
     ttf = font->ttf_source;
     col = font->default_color;
@@ -1432,6 +2075,7 @@ void FC_ClearFont(FC_Font* font)
     }
     free(font->glyph_cache);
     font->glyph_cache = NULL;
+    FC_FreeGlyphCacheSurfaces(font);
 
     // Reset font
     FC_Init(font);
@@ -1461,9 +2105,15 @@ void FC_FreeFont(FC_Font* font)
         #endif
     }
     free(font->glyph_cache);
+    FC_FreeGlyphCacheSurfaces(font);
 
     free(font->loading_string);
 
+    #ifdef ENABLE_SDL_GEOMETRY
+    free(font->batch_vertices);
+    free(font->batch_indices);
+    #endif
+
     free(font);
 
     // If the last font has been freed; assume shutdown and free the global variables
@@ -1498,6 +2148,13 @@ Uint8 FC_AddGlyphToCache(FC_Font* font, SDL_Surface* glyph_surface)
     if(dest == NULL)
         return 0;
 
+    // Keep the CPU copy in sync
+    if(font->glyph_cache_surfaces[font->last_glyph.cache_level] != NULL)
+    {
+        SDL_Rect destrect = font->last_glyph.rect;
+        SDL_BlitSurface(glyph_surface, NULL, font->glyph_cache_surfaces[font->last_glyph.cache_level], &destrect);
+    }
+
     #ifdef FC_USE_SDL_GPU
     {
         GPU_Target* target = GPU_LoadTarget(dest);
@@ -1561,45 +2218,18 @@ Uint8 FC_AddGlyphToCache(FC_Font* font, SDL_Surface* glyph_surface)
 
 unsigned int FC_GetNumCodepoints(FC_Font* font)
 {
-    FC_Map* glyphs;
-    int i;
-    unsigned int result = 0;
     if(font == NULL || font->glyphs == NULL)
         return 0;
 
-    glyphs = font->glyphs;
-
-    for(i = 0; i < glyphs->num_buckets; ++i)
-    {
-        FC_MapNode* node;
-        for(node = glyphs->buckets[i]; node != NULL; node = node->next)
-        {
-            result++;
-        }
-    }
-
-    return result;
+    return FC_MapGetKeys(font->glyphs, NULL);
 }
 
 void FC_GetCodepoints(FC_Font* font, Uint32* result)
 {
-    FC_Map* glyphs;
-    int i;
-    unsigned int count = 0;
-    if(font == NULL || font->glyphs == NULL)
+    if(font == NULL || font->glyphs == NULL || result == NULL)
         return;
 
-    glyphs = font->glyphs;
-
-    for(i = 0; i < glyphs->num_buckets; ++i)
-    {
-        FC_MapNode* node;
-        for(node = glyphs->buckets[i]; node != NULL; node = node->next)
-        {
-            result[count] = node->key;
-            count++;
-        }
-    }
+    FC_MapGetKeys(font->glyphs, result);
 }
 
 Uint8 FC_GetGlyphData(FC_Font* font, FC_GlyphData* result, Uint32 codepoint)
@@ -1668,13 +2298,16 @@ Uint8 FC_GetGlyphData(FC_Font* font, FC_GlyphData* result, Uint32 codepoint)
 
 FC_GlyphData* FC_SetGlyphData(FC_Font* font, Uint32 codepoint, FC_GlyphData glyph_data)
 {
-    return FC_MapInsert(font->glyphs, codepoint, glyph_data);
+    FC_GlyphData* glyph = FC_MapInsert(font->glyphs, codepoint, glyph_data);
+    FC_UpdateGridGlyph(font, codepoint, glyph);
+    return glyph;
 }
 
 
 
 // Drawing
-static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text)
+// Renders [text, end).  A multi-byte character cut off by 'end' is not drawn.
+static FC_Rect FC_RenderLeftRange(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text, const char* end)
 {
     const char* c = text;
     FC_Rect srcRect;
@@ -1702,7 +2335,7 @@ static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, F
 
     int newlineX = x;
 
-    for(; *c != '\0'; c++)
+    for(; c < end; c++)
     {
         if(*c == '\n')
         {
@@ -1711,6 +2344,9 @@ static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, F
             continue;
         }
 
+        if(U8_charsize(c) > end - c)
+            break;
+
         codepoint = FC_GetCodepointFromUTF8(&c, 1);  // Increments 'c' to skip the extra UTF-8 bytes
         if(!FC_GetGlyphData(font, &glyph, codepoint))
         {
@@ -1749,6 +2385,14 @@ static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, F
     return dirtyRect;
 }
 
+static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text)
+{
+    if(text == NULL)
+        return FC_MakeRect(x, y, 0, 0);
+
+    return FC_RenderLeftRange(font, dest, x, y, scale, text, text + strlen(text));
+}
+
 static void set_color_for_all_caches(FC_Font* font, SDL_Color color)
 {
     // TODO: How can I predict which glyph caches are to be used?
@@ -1774,6 +2418,156 @@ FC_Rect FC_Draw(FC_Font* font, FC_Target* dest, float x, float y, const char* fo
     return FC_RenderLeft(font, dest, x, y, FC_MakeScale(1,1), fc_buffer);
 }
 
+FC_Rect FC_DrawText(FC_Font* font, FC_Target* dest, float x, float y, const char* text, int length)
+{
+    if(text == NULL || font == NULL)
+        return FC_MakeRect(x, y, 0, 0);
+
+    if(length < 0)
+        length = strlen(text);
+
+    set_color_for_all_caches(font, font->default_color);
+
+    return FC_RenderLeftRange(font, dest, x, y, FC_MakeScale(1,1), text, text + length);
+}
+
+
+#ifdef ENABLE_SDL_GEOMETRY
+// Makes room for at least num_quads glyph quads in the batch buffers
+static Uint8 FC_ReserveBatch(FC_Font* font, int num_quads)
+{
+    int i;
+    SDL_Vertex* vertices;
+    int* indices;
+
+    if(num_quads <= font->batch_capacity)
+        return 1;
+
+    num_quads = FC_MAX(num_quads, font->batch_capacity*2);
+
+    vertices = (SDL_Vertex*)realloc(font->batch_vertices, num_quads * 4 * sizeof(SDL_Vertex));
+    if(vertices == NULL)
+        return 0;
+    font->batch_vertices = vertices;
+
+    indices = (int*)realloc(font->batch_indices, num_quads * 6 * sizeof(int));
+    if(indices == NULL)
+        return 0;
+    font->batch_indices = indices;
+
+    // The index pattern never changes, only the vertices do
+    for(i = font->batch_capacity; i < num_quads; ++i)
+    {
+        indices[i*6 + 0] = i*4 + 0;
+        indices[i*6 + 1] = i*4 + 1;
+        indices[i*6 + 2] = i*4 + 2;
+        indices[i*6 + 3] = i*4 + 2;
+        indices[i*6 + 4] = i*4 + 1;
+        indices[i*6 + 5] = i*4 + 3;
+    }
+
+    font->batch_capacity = num_quads;
+    return 1;
+}
+
+static_inline void FC_SetBatchQuad(SDL_Vertex* v, float x, float y, SDL_Rect* src, float tex_w, float tex_h, SDL_Color color)
+{
+    float x2 = x + src->w;
+    float y2 = y + src->h;
+    float u1 = src->x / tex_w;
+    float v1 = src->y / tex_h;
+    float u2 = (src->x + src->w) / tex_w;
+    float v2 = (src->y + src->h) / tex_h;
+
+    v[0].position.x = x;  v[0].position.y = y;  v[0].tex_coord.x = u1; v[0].tex_coord.y = v1;
+    v[1].position.x = x2; v[1].position.y = y;  v[1].tex_coord.x = u2; v[1].tex_coord.y = v1;
+    v[2].position.x = x;  v[2].position.y = y2; v[2].tex_coord.x = u1; v[2].tex_coord.y = v2;
+    v[3].position.x = x2; v[3].position.y = y2; v[3].tex_coord.x = u2; v[3].tex_coord.y = v2;
+    v[0].color = v[1].color = v[2].color = v[3].color = color;
+}
+#endif
+
+
+FC_Rect FC_DrawGrid(FC_Font* font, FC_Target* dest, float x, float y, float line_height, const Uint8* cells, int cols, int rows, int pitch)
+{
+    return FC_DrawGridColors(font, dest, x, y, line_height, cells, cols, rows, pitch, NULL, 0);
+}
+
+FC_Rect FC_DrawGridColors(FC_Font* font, FC_Target* dest, float x, float y, float line_height, const Uint8* cells, int cols, int rows, int pitch, const SDL_Color* colors, int color_pitch)
+{
+    FC_Rect dirtyRect = FC_MakeRect(x, y, 0, 0);
+    float advance;
+    int level, row, col;
+
+    if(font == NULL || cells == NULL || dest == NULL || font->glyph_cache_count == 0 || cols <= 0 || rows <= 0)
+        return dirtyRect;
+
+    // Monospace: every cell advances by the width of a space
+    advance = font->grid_glyphs[' '].rect.w + font->letterSpacing;
+
+    #ifdef ENABLE_SDL_GEOMETRY
+    {
+        // Vertex colors carry the text color, keep the texture modulation neutral
+        SDL_Color white = {255, 255, 255, 255};
+        if(!FC_ReserveBatch(font, cols*rows))
+            return dirtyRect;
+        set_color_for_all_caches(font, white);
+    }
+    #else
+    set_color_for_all_caches(font, font->default_color);
+    #endif
+
+    for(level = 0; level < font->glyph_cache_count; ++level)
+    {
+        FC_Image* cache_image = FC_GetGlyphCacheLevel(font, level);
+        int num_quads = 0;
+        #ifdef ENABLE_SDL_GEOMETRY
+        int tex_w, tex_h;
+        SDL_QueryTexture(cache_image, NULL, NULL, &tex_w, &tex_h);
+        #endif
+
+        for(row = 0; row < rows; ++row)
+        {
+            const Uint8* line = cells + row*pitch;
+            const SDL_Color* line_colors = (colors != NULL)? colors + row*color_pitch : NULL;
+            float destY = y + row*line_height;
+            for(col = 0; col < cols; ++col)
+            {
+                FC_GlyphData* glyph = &font->grid_glyphs[line[col]];
+                if(glyph->cache_level != level)
+                    continue;
+
+                #ifdef ENABLE_SDL_GEOMETRY
+                FC_SetBatchQuad(&font->batch_vertices[num_quads*4], x + col*advance, destY, &glyph->rect, tex_w, tex_h,
+                                (line_colors != NULL)? line_colors[col] : font->default_color);
+                #else
+                {
+                    FC_Rect srcRect = FC_MakeRect(glyph->rect.x, glyph->rect.y, glyph->rect.w, glyph->rect.h);
+                    // Without vertex colors every colored glyph costs a texture state change
+                    if(line_colors != NULL)
+                        set_color(cache_image, line_colors[col].r, line_colors[col].g, line_colors[col].b, FC_GET_ALPHA(line_colors[col]));
+                    fc_render_callback(cache_image, &srcRect, dest, x + col*advance, destY, 1, 1);
+                }
+                #endif
+                ++num_quads;
+            }
+        }
+
+        #ifdef ENABLE_SDL_GEOMETRY
+        if(num_quads > 0)
+            SDL_RenderGeometry(dest, cache_image, font->batch_vertices, num_quads*4, font->batch_indices, num_quads*6);
+        #else
+        (void)num_quads;
+        if(colors != NULL)
+            set_color(cache_image, font->default_color.r, font->default_color.g, font->default_color.b, FC_GET_ALPHA(font->default_color));
+        #endif
+    }
+
+    dirtyRect.w = cols*advance;
+    dirtyRect.h = (rows - 1)*line_height + font->height;
+    return dirtyRect;
+}
+
 
 
 typedef struct FC_StringList
@@ -2507,18 +3301,20 @@ Uint16 FC_GetHeight(FC_Font* font, const char* formatted_text, ...)
     return font->height*numLines + font->lineSpacing*(numLines - 1);  //height*numLines;
 }
 
-Uint16 FC_GetWidth(FC_Font* font, const char* formatted_text, ...)
+Uint16 FC_GetTextWidth(FC_Font* font, const char* text, int length)
 {
-    if(formatted_text == NULL || font == NULL)
+    if(text == NULL || font == NULL)
         return 0;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    if(length < 0)
+        length = strlen(text);
 
     const char* c;
+    const char* end = text + length;
     Uint16 width = 0;
     Uint16 bigWidth = 0;  // Allows for multi-line strings
 
-    for (c = fc_buffer; *c != '\0'; c++)
+    for (c = text; c < end; c++)
     {
         if(*c == '\n')
         {
@@ -2527,6 +3323,9 @@ Uint16 FC_GetWidth(FC_Font* font, const char* formatted_text, ...)
             continue;
         }
 
+        if(U8_charsize(c) > end - c)
+            break;
+
         FC_GlyphData glyph;
         Uint32 codepoint = FC_GetCodepointFromUTF8(&c, 1);
         if(FC_GetGlyphData(font, &glyph, codepoint) || FC_GetGlyphData(font, &glyph, ' '))
@@ -2537,6 +3336,16 @@ Uint16 FC_GetWidth(FC_Font* font, const char* formatted_text, ...)
     return bigWidth;
 }
 
+Uint16 FC_GetWidth(FC_Font* font, const char* formatted_text, ...)
+{
+    if(formatted_text == NULL || font == NULL)
+        return 0;
+
+    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+
+    return FC_GetTextWidth(font, fc_buffer, -1);
+}
+
 // If width == -1, use no width limit
 FC_Rect FC_GetCharacterOffset(FC_Font* font, Uint16 position_index, int column_width, const char* formatted_text, ...)
 {
@@ -0,0 +1,584 @@
+#include "ascii_convert.h"
+
+#include <string.h>
+#include <array>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define ASCII_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+static const int color_range_full = 256;
+static const int color_range_lim = 220;
+static const int color_range_lim_offs = 16;
+
+static const char edge_glyphs[] = EDGE_GLYPHS;
+
+/**
+ * @brief Portable reference kernel, also handles the tails of the vector kernels.
+ *          Both loops have compile time bounds so every tile size gets its own unrolled body
+ */
+template <int W, int H>
+static void tile_row_sums_scalar(const uint8_t* src, int linesize, int tiles, uint16_t* sums)
+{
+    for (int tile = 0; tile < tiles; tile++, src += W)
+    {
+        unsigned int sum = 0;
+        for (int y = 0; y < H; y++)
+        {
+            const uint8_t* line = src + y * linesize;
+            for (int x = 0; x < W; x++)
+            {
+                sum += line[x];
+            }
+        }
+        sums[tile] = (uint16_t)sum;
+    }
+}
+
+/**
+ * @brief Vector kernels available for a tile size, none by default
+ */
+template <int W, int H>
+struct TileVectorKernels
+{
+    static constexpr TileRowKernel sse2 = nullptr;
+    static constexpr TileRowKernel avx2 = nullptr;
+};
+
+#ifdef ASCII_CONVERT_X86
+/**
+ * @brief Reduces 4 tiles of width 4 per iteration: rows are widened to 16 bit and added,
+ *          then neighbouring columns are folded twice with a multiply-add against ones
+ */
+template <int H>
+__attribute__((target("sse2")))
+static void tile_row_sums_sse2_w4(const uint8_t* src, int linesize, int tiles, uint16_t* sums)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    int tile = 0;
+
+    for (; tile + 4 <= tiles; tile += 4, src += 16)
+    {
+        __m128i lo = zero;
+        __m128i hi = zero;
+        for (int row = 0; row < H; row++)
+        {
+            const __m128i px = _mm_loadu_si128((const __m128i*)(src + row * linesize));
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(px, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(px, zero));
+        }
+
+        const __m128i pairs = _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+        const __m128i quads = _mm_madd_epi16(pairs, ones);
+        _mm_storel_epi64((__m128i*)(sums + tile), _mm_packs_epi32(quads, quads));
+    }
+
+    tile_row_sums_scalar<4, H>(src, linesize, tiles - tile, sums + tile);
+}
+
+/**
+ * @brief Same reduction as the SSE2 kernel on 8 tiles per iteration, lanes are
+ *          reordered once at the end since AVX2 packs work per 128-bit lane
+ */
+template <int H>
+__attribute__((target("avx2")))
+static void tile_row_sums_avx2_w4(const uint8_t* src, int linesize, int tiles, uint16_t* sums)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    int tile = 0;
+
+    for (; tile + 8 <= tiles; tile += 8, src += 32)
+    {
+        __m256i lo = zero;
+        __m256i hi = zero;
+        for (int row = 0; row < H; row++)
+        {
+            const __m256i px = _mm256_loadu_si256((const __m256i*)(src + row * linesize));
+            lo = _mm256_add_epi16(lo, _mm256_unpacklo_epi8(px, zero));
+            hi = _mm256_add_epi16(hi, _mm256_unpackhi_epi8(px, zero));
+        }
+
+        const __m256i pairs = _mm256_packs_epi32(_mm256_madd_epi16(lo, ones), _mm256_madd_epi16(hi, ones));
+        const __m256i quads = _mm256_madd_epi16(pairs, ones);
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(quads, quads), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(sums + tile), _mm256_castsi256_si128(packed));
+    }
+
+    tile_row_sums_sse2_w4<H>(src, linesize, tiles - tile, sums + tile);
+}
+
+/**
+ * @brief Tiles 8 or 16 pixels wide, the sum of absolute differences against zero
+ *          adds 8 neighbouring bytes per instruction, 16 bytes per iteration
+ */
+template <int W, int H>
+__attribute__((target("sse2")))
+static void tile_row_sums_sse2_sad(const uint8_t* src, int linesize, int tiles, uint16_t* sums)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const int step = 16 / W;
+    int tile = 0;
+
+    for (; tile + step <= tiles; tile += step, src += 16)
+    {
+        __m128i acc = zero;
+        for (int row = 0; row < H; row++)
+        {
+            const __m128i px = _mm_loadu_si128((const __m128i*)(src + row * linesize));
+            acc = _mm_add_epi32(acc, _mm_sad_epu8(px, zero));
+        }
+
+        if (W == 8)
+        {
+            sums[tile] = (uint16_t)_mm_cvtsi128_si32(acc);
+            sums[tile + 1] = (uint16_t)_mm_extract_epi16(acc, 4);
+        }
+        else
+        {
+            sums[tile] = (uint16_t)_mm_cvtsi128_si32(_mm_add_epi32(acc, _mm_srli_si128(acc, 8)));
+        }
+    }
+
+    tile_row_sums_scalar<W, H>(src, linesize, tiles - tile, sums + tile);
+}
+
+/**
+ * @brief Same reduction as the SSE2 SAD kernel on 32 bytes per iteration
+ */
+template <int W, int H>
+__attribute__((target("avx2")))
+static void tile_row_sums_avx2_sad(const uint8_t* src, int linesize, int tiles, uint16_t* sums)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const int step = 32 / W;
+    int tile = 0;
+
+    for (; tile + step <= tiles; tile += step, src += 32)
+    {
+        __m256i acc = zero;
+        for (int row = 0; row < H; row++)
+        {
+            const __m256i px = _mm256_loadu_si256((const __m256i*)(src + row * linesize));
+            acc = _mm256_add_epi32(acc, _mm256_sad_epu8(px, zero));
+        }
+
+        /* One 64-bit partial sum per 8 bytes */
+        uint64_t partial[4];
+        _mm256_storeu_si256((__m256i*)partial, acc);
+        if (W == 8)
+        {
+            sums[tile] = (uint16_t)partial[0];
+            sums[tile + 1] = (uint16_t)partial[1];
+            sums[tile + 2] = (uint16_t)partial[2];
+            sums[tile + 3] = (uint16_t)partial[3];
+        }
+        else
+        {
+            sums[tile] = (uint16_t)(partial[0] + partial[1]);
+            sums[tile + 1] = (uint16_t)(partial[2] + partial[3]);
+        }
+    }
+
+    tile_row_sums_sse2_sad<W, H>(src, linesize, tiles - tile, sums + tile);
+}
+
+template <int H>
+struct TileVectorKernels<4, H>
+{
+    static constexpr TileRowKernel sse2 = tile_row_sums_sse2_w4<H>;
+    static constexpr TileRowKernel avx2 = tile_row_sums_avx2_w4<H>;
+};
+
+template <int H>
+struct TileVectorKernels<8, H>
+{
+    static constexpr TileRowKernel sse2 = tile_row_sums_sse2_sad<8, H>;
+    static constexpr TileRowKernel avx2 = tile_row_sums_avx2_sad<8, H>;
+};
+
+template <int H>
+struct TileVectorKernels<16, H>
+{
+    static constexpr TileRowKernel sse2 = tile_row_sums_sse2_sad<16, H>;
+    static constexpr TileRowKernel avx2 = tile_row_sums_avx2_sad<16, H>;
+};
+#endif
+
+typedef struct TileKernelEntry
+{
+    int width;
+    int height;
+    TileRowKernel scalar;
+    TileRowKernel sse2;
+    TileRowKernel avx2;
+}TTileKernelEntry;
+
+#define TILE_KERNEL(W, H) \
+    { W, H, tile_row_sums_scalar<W, H>, TileVectorKernels<W, H>::sse2, TileVectorKernels<W, H>::avx2 }
+#define TILE_KERNEL_ROW(W) \
+    TILE_KERNEL(W, 1), TILE_KERNEL(W, 2), TILE_KERNEL(W, 4), TILE_KERNEL(W, 8), TILE_KERNEL(W, 16)
+
+/* Every combination of 1, 2, 4, 8 and 16 pixel tile edges, one instantiation each */
+static const TTileKernelEntry tile_kernels[] =
+{
+    TILE_KERNEL_ROW(1),
+    TILE_KERNEL_ROW(2),
+    TILE_KERNEL_ROW(4),
+    TILE_KERNEL_ROW(8),
+    TILE_KERNEL_ROW(16)
+};
+
+TileRowKernel select_tile_row_kernel(int tile_w, int tile_h, const char** name)
+{
+    const TTileKernelEntry* entry = nullptr;
+    for (const TTileKernelEntry& candidate : tile_kernels)
+    {
+        if (candidate.width == tile_w && candidate.height == tile_h)
+        {
+            entry = &candidate;
+            break;
+        }
+    }
+
+    if (entry == nullptr)
+    {
+        if (name)
+        {
+            *name = "none";
+        }
+        return nullptr;
+    }
+
+    const char* selected = "scalar";
+    TileRowKernel kernel = entry->scalar;
+
+#ifdef ASCII_CONVERT_X86
+    __builtin_cpu_init();
+    if (entry->avx2 && __builtin_cpu_supports("avx2"))
+    {
+        selected = "avx2";
+        kernel = entry->avx2;
+    }
+    else if (entry->sse2 && __builtin_cpu_supports("sse2"))
+    {
+        selected = "sse2";
+        kernel = entry->sse2;
+    }
+#endif
+
+    if (name)
+    {
+        *name = selected;
+    }
+
+    return kernel;
+}
+
+void build_glyph_lut(char* lut, int tile_pixels, bool limited_range, const char* ramp, int ramp_len)
+{
+    const int steps = ramp_len - 1;
+    const int max_sum = 255 * tile_pixels;
+
+    for (int sum = 0; sum <= max_sum; sum++)
+    {
+        int tile_luma = sum / tile_pixels;
+        int character_index;
+
+        /* Check if the color range is limited */
+        if (limited_range)
+        {
+            /* Prevent negative values after averaging the tile */
+            tile_luma = (tile_luma > color_range_lim_offs) ? tile_luma - color_range_lim_offs : 0;
+            character_index = (2 * tile_luma * steps + color_range_lim) / (2 * color_range_lim);
+        }
+        else
+        {
+            character_index = (2 * tile_luma * steps + color_range_full) / (2 * color_range_full);
+        }
+
+        /* Super-white input in limited range would step past the ramp */
+        lut[sum] = ramp[(character_index < steps) ? character_index : steps];
+    }
+}
+
+void tile_sums_to_ascii(const uint16_t* sums, int tiles, const char* lut, char* ascii)
+{
+    for (int tile = 0; tile < tiles; tile++)
+    {
+        ascii[tile] = lut[sums[tile]];
+    }
+}
+
+/* Accumulates one pixel row into the luma and Sobel structure tensor column sums, columns [first, last) */
+typedef void (*SobelRowKernel)(const uint8_t* above, const uint8_t* line, const uint8_t* below, int first, int last,
+                               int32_t* col_sum, int32_t* col_xx, int32_t* col_yy, int32_t* col_xy);
+
+/**
+ * @brief Portable Sobel row kernel, also handles the tail of the vector kernel. The rows are
+ *          read only and never overlap the accumulators, restrict lets the compiler vectorize it
+ */
+static void sobel_row_scalar(const uint8_t* __restrict above, const uint8_t* __restrict line, const uint8_t* __restrict below,
+                             int first, int last, int32_t* __restrict col_sum, int32_t* __restrict col_xx,
+                             int32_t* __restrict col_yy, int32_t* __restrict col_xy)
+{
+    for (int x = first; x < last; x++)
+    {
+        const int gx = (above[x + 1] + 2 * line[x + 1] + below[x + 1]) - (above[x - 1] + 2 * line[x - 1] + below[x - 1]);
+        const int gy = (below[x - 1] + 2 * below[x] + below[x + 1]) - (above[x - 1] + 2 * above[x] + above[x + 1]);
+        col_sum[x] += line[x];
+        col_xx[x] += gx * gx;
+        col_yy[x] += gy * gy;
+        col_xy[x] += gx * gy;
+    }
+}
+
+#ifdef ASCII_CONVERT_X86
+__attribute__((target("sse2")))
+static inline __m128i load_widened_sse2(const uint8_t* src)
+{
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)src), _mm_setzero_si128());
+}
+
+/**
+ * @brief Adds 8 signed 16-bit products a * b to 8 32-bit accumulators, the products need 32 bits
+ */
+__attribute__((target("sse2")))
+static inline void accumulate_products_sse2(int32_t* acc, __m128i a, __m128i b)
+{
+    const __m128i lo = _mm_mullo_epi16(a, b);
+    const __m128i hi = _mm_mulhi_epi16(a, b);
+    _mm_storeu_si128((__m128i*)acc, _mm_add_epi32(_mm_loadu_si128((const __m128i*)acc), _mm_unpacklo_epi16(lo, hi)));
+    _mm_storeu_si128((__m128i*)(acc + 4), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(acc + 4)), _mm_unpackhi_epi16(lo, hi)));
+}
+
+/**
+ * @brief 8 columns per iteration in 16-bit lanes, gradients stay within +-1020
+ */
+__attribute__((target("sse2")))
+static void sobel_row_sse2(const uint8_t* above, const uint8_t* line, const uint8_t* below, int first, int last,
+                           int32_t* col_sum, int32_t* col_xx, int32_t* col_yy, int32_t* col_xy)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    int x = first;
+
+    /* Loads reach one column past the block, which is still inside [0, last] */
+    for (; x + 8 <= last; x += 8)
+    {
+        const __m128i a0 = load_widened_sse2(above + x - 1);
+        const __m128i a1 = load_widened_sse2(above + x);
+        const __m128i a2 = load_widened_sse2(above + x + 1);
+        const __m128i l0 = load_widened_sse2(line + x - 1);
+        const __m128i l1 = load_widened_sse2(line + x);
+        const __m128i l2 = load_widened_sse2(line + x + 1);
+        const __m128i b0 = load_widened_sse2(below + x - 1);
+        const __m128i b1 = load_widened_sse2(below + x);
+        const __m128i b2 = load_widened_sse2(below + x + 1);
+
+        const __m128i right = _mm_add_epi16(_mm_add_epi16(a2, b2), _mm_slli_epi16(l2, 1));
+        const __m128i left = _mm_add_epi16(_mm_add_epi16(a0, b0), _mm_slli_epi16(l0, 1));
+        const __m128i bottom = _mm_add_epi16(_mm_add_epi16(b0, b2), _mm_slli_epi16(b1, 1));
+        const __m128i top = _mm_add_epi16(_mm_add_epi16(a0, a2), _mm_slli_epi16(a1, 1));
+        const __m128i gx = _mm_sub_epi16(right, left);
+        const __m128i gy = _mm_sub_epi16(bottom, top);
+
+        /* Multiplying by one widens the luma with the same helper */
+        accumulate_products_sse2(col_sum + x, l1, ones);
+        accumulate_products_sse2(col_xx + x, gx, gx);
+        accumulate_products_sse2(col_yy + x, gy, gy);
+        accumulate_products_sse2(col_xy + x, gx, gy);
+    }
+
+    sobel_row_scalar(above, line, below, x, last, col_sum, col_xx, col_yy, col_xy);
+}
+#endif
+
+static SobelRowKernel select_sobel_row_kernel()
+{
+#ifdef ASCII_CONVERT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return sobel_row_sse2;
+    }
+#endif
+    return sobel_row_scalar;
+}
+
+void tile_row_edges_to_ascii(const uint8_t* plane, int linesize, int plane_height, int y, int tile_w, int tile_h,
+                             int tiles, int threshold, const char* lut, int32_t* columns, char* ascii)
+{
+    static const SobelRowKernel sobel_row = select_sobel_row_kernel();
+
+    const int span = tiles * tile_w;
+    int32_t* col_sum = columns;
+    int32_t* col_xx = col_sum + span;
+    int32_t* col_yy = col_xx + span;
+    int32_t* col_xy = col_yy + span;
+
+    memset(columns, 0, 4 * span * sizeof(int32_t));
+
+    /* Per pixel column accumulators keep the inner loop free of tile bookkeeping,
+       the border columns only contribute luma */
+    for (int row = y; row < y + tile_h; row++)
+    {
+        const uint8_t* above = plane + ((row > 0) ? row - 1 : 0) * linesize;
+        const uint8_t* line = plane + row * linesize;
+        const uint8_t* below = plane + ((row + 1 < plane_height) ? row + 1 : row) * linesize;
+
+        col_sum[0] += line[0];
+        sobel_row(above, line, below, 1, span - 1, col_sum, col_xx, col_yy, col_xy);
+        if (span > 1)
+        {
+            col_sum[span - 1] += line[span - 1];
+        }
+    }
+
+    const int64_t tile_pixels = tile_w * tile_h;
+    const int64_t min_energy = (int64_t)threshold * threshold * tile_pixels;
+
+    for (int tile = 0; tile < tiles; tile++)
+    {
+        int32_t sum = 0;
+        int64_t sxx = 0;
+        int64_t syy = 0;
+        int64_t sxy = 0;
+        for (int x = tile * tile_w; x < (tile + 1) * tile_w; x++)
+        {
+            sum += col_sum[x];
+            sxx += col_xx[x];
+            syy += col_yy[x];
+            sxy += col_xy[x];
+        }
+
+        ascii[tile] = lut[sum];
+
+        /* The doubled angle vector (sxx - syy, 2 sxy) points along the dominant gradient,
+           its length relative to the energy tells how consistent the orientation is */
+        const int64_t energy = sxx + syy;
+        const int64_t a = sxx - syy;
+        const int64_t b = 2 * sxy;
+        if (energy > min_energy && 4 * (a * a + b * b) > energy * energy)
+        {
+            if ((a < 0 ? -a : a) >= (b < 0 ? -b : b))
+            {
+                ascii[tile] = edge_glyphs[(a > 0) ? 0 : 1];
+            }
+            else
+            {
+                ascii[tile] = edge_glyphs[(b > 0) ? 2 : 3];
+            }
+        }
+    }
+}
+
+void build_quadrant_lut(uint8_t* lut, int quadrant_pixels, bool limited_range)
+{
+    const int max_sum = 255 * quadrant_pixels;
+
+    for (int sum = 0; sum <= max_sum; sum++)
+    {
+        int luma = sum / quadrant_pixels;
+        int range = color_range_full - 1;
+
+        if (limited_range)
+        {
+            luma = (luma > color_range_lim_offs) ? luma - color_range_lim_offs : 0;
+            range = color_range_lim - 1;
+        }
+        luma = (luma < range) ? luma : range;
+
+        /* Dark quadrants want dense glyphs, same polarity as the luma ramp */
+        lut[sum] = (uint8_t)(SHAPE_LEVELS - 1 - (2 * luma * (SHAPE_LEVELS - 1) + range) / (2 * range));
+    }
+}
+
+void build_shape_lut(char* lut, const TGlyphCoverage* glyphs)
+{
+    const int level_scale = 255 / (SHAPE_LEVELS - 1);
+
+    for (int key = 0; key < SHAPE_LUT_SIZE; key++)
+    {
+        int target[SHAPE_QUADRANTS];
+        for (int quadrant = 0; quadrant < SHAPE_QUADRANTS; quadrant++)
+        {
+            target[quadrant] = ((key >> (4 * (SHAPE_QUADRANTS - 1 - quadrant))) & (SHAPE_LEVELS - 1)) * level_scale;
+        }
+
+        /* Each quadrant array is contiguous, so distances to all glyphs build up one quadrant at a time in vector lanes */
+        int distance[256] = {0};
+        for (int quadrant = 0; quadrant < SHAPE_QUADRANTS; quadrant++)
+        {
+            const uint8_t* coverage = glyphs->coverage[quadrant];
+            for (int glyph = 0; glyph < glyphs->count; glyph++)
+            {
+                const int diff = target[quadrant] - coverage[glyph];
+                distance[glyph] += diff * diff;
+            }
+        }
+
+        int best_distance = 0x7FFFFFFF;
+        char best = ' ';
+        for (int glyph = 0; glyph < glyphs->count; glyph++)
+        {
+            if (distance[glyph] < best_distance)
+            {
+                best_distance = distance[glyph];
+                best = glyphs->glyphs[glyph];
+            }
+        }
+
+        lut[key] = best;
+    }
+}
+
+void quadrants_to_ascii(const uint16_t* top, const uint16_t* bottom, int tiles, const uint8_t* level_lut,
+                        const char* shape_lut, char* ascii)
+{
+    for (int tile = 0; tile < tiles; tile++)
+    {
+        const int key = (level_lut[top[2 * tile]] << 12) | (level_lut[top[2 * tile + 1]] << 8) |
+                        (level_lut[bottom[2 * tile]] << 4) | level_lut[bottom[2 * tile + 1]];
+        ascii[tile] = shape_lut[key];
+    }
+}
+
+void luma_to_ascii(const uint8_t* luma, int count, const char* lut, char* ascii)
+{
+    for (int i = 0; i < count; i++)
+    {
+        ascii[i] = lut[luma[i]];
+    }
+}
+
+void normalize_cell_colors(uint8_t* rgba, int count)
+{
+    /* 255 / brightest channel in 16.16 fixed point */
+    static const std::array<uint32_t, 256> scale = []
+    {
+        std::array<uint32_t, 256> table{};
+        for (int brightest = 1; brightest < 256; brightest++)
+        {
+            table[brightest] = (255u << 16) / brightest;
+        }
+        return table;
+    }();
+
+    for (int cell = 0; cell < count; cell++, rgba += 4)
+    {
+        uint8_t brightest = (rgba[0] > rgba[1]) ? rgba[0] : rgba[1];
+        brightest = (brightest > rgba[2]) ? brightest : rgba[2];
+        if (brightest == 0)
+        {
+            /* No hue to keep, draw black cells in white */
+            rgba[0] = rgba[1] = rgba[2] = 255;
+            continue;
+        }
+
+        rgba[0] = (uint8_t)((rgba[0] * scale[brightest] + 0x8000) >> 16);
+        rgba[1] = (uint8_t)((rgba[1] * scale[brightest] + 0x8000) >> 16);
+        rgba[2] = (uint8_t)((rgba[2] * scale[brightest] + 0x8000) >> 16);
+    }
+}
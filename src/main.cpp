@@ -3,6 +3,10 @@
 #include <vector>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <atomic>
 
 // FFmpeg
 extern "C" {
@@ -16,10 +20,16 @@ extern "C" {
 #include <SDL.h>
 #include <SDL_ttf.h>
 #include "SDL_FontCache.h"
+#include "ascii_convert.h"
+#include "term_output.h"
+#include "media_input.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/stat.h>
 
 #define DEFAULT_PTSIZE  9
 #define WIDTH   480
@@ -27,12 +37,67 @@ extern "C" {
 
 using namespace std;
 
+typedef enum OutputMode
+{
+    OUTPUT_SDL,
+    OUTPUT_TERM
+}EOutputMode;
+
+typedef enum RenderMode
+{
+    RENDER_GEOMETRY,
+    RENDER_COMPOSITE
+}ERenderMode;
+
+typedef enum ConvertMode
+{
+    CONVERT_AUTO,
+    CONVERT_TILES,
+    CONVERT_SWSCALE
+}EConvertMode;
+
+typedef enum GlyphMode
+{
+    GLYPHS_LUMA,
+    GLYPHS_SHAPE
+}EGlyphMode;
+
+/* Frame composited on the CPU from prerasterized glyph cells and uploaded as a single texture */
+typedef struct CompositeContext
+{
+    SDL_Texture* texture;
+    int cell_w;
+    int cell_h;
+    vector<uint32_t> glyph_cells;
+    vector<uint32_t> pixels;
+}TCompositeCtx;
+
+/* Previous frame kept for delta rendering, rows whose cells did not change are not redrawn */
+typedef struct DeltaContext
+{
+    bool enabled;
+    /* False until the canvas holds a complete frame */
+    bool valid;
+    vector<char> prev;
+    vector<uint8_t> prev_colors;
+    vector<uint8_t> dirty;
+    /* Persistent render target for the geometry renderer */
+    SDL_Texture* canvas;
+    int cell_w;
+    int glyph_h;
+}TDeltaCtx;
+
 typedef struct SDLContext
 {
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Event event;
     FC_Font* fc_font;
+
+    ERenderMode render_mode;
+    float line_height;
+    TCompositeCtx composite;
+    TDeltaCtx delta;
 }TSDLContext;
 
 typedef struct FfmpegContext
@@ -43,41 +108,571 @@ typedef struct FfmpegContext
     AVPacket* pkt;
     AVFormatContext* input_ctx;
     AVCodecContext* codec_ctx;
+    TMediaInput input;
 
     vector<uint8_t> framebuf;
 
     char* file = nullptr;
     bool end_of_stream = false;
+    bool flush_sent = false;
+    int lowres = 0;
     int got_image = 0;
     int stream_idx;
+    /* Seek generation of the packets fed to the decoder, decoded frames before skip_pts are dropped */
+    int serial = 0;
+    int64_t skip_pts = AV_NOPTS_VALUE;
 }TFfmpegCtx;
 
+/* Bounded ring of decoded frames shared by the decode thread (producer) and the render loop (consumer) */
+typedef struct FrameQueue
+{
+    vector<AVFrame*> frames;
+    /* Seek generation each frame was decoded in */
+    vector<int> serials;
+    size_t rindex = 0;
+    size_t windex = 0;
+    size_t size = 0;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    bool finished = false;
+    bool abort = false;
+    /* Seek generation the decoder drained in, a seek to a later one resumes decoding.
+       -1 once the decoder has exited */
+    int finished_serial = -1;
+}TFrameQueue;
+
+/* Bounded ring of video packets shared by the demux thread (producer) and the decode thread (consumer) */
+typedef struct PacketQueue
+{
+    vector<AVPacket*> packets;
+    size_t rindex = 0;
+    size_t windex = 0;
+    size_t size = 0;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    bool finished = false;
+    bool abort = false;
+
+    /* Seek requested by the render loop, picked up by the demux thread */
+    bool seek_req = false;
+    int64_t seek_target = 0;
+    /* Set from the request until the demux thread has flushed the queue for it */
+    bool seek_pending = false;
+    /* Bumped on every seek, packets queued before it were dropped. Frames decoded
+       after a seek are only shown from serial_target on */
+    int serial = 0;
+    int64_t serial_target = AV_NOPTS_VALUE;
+}TPacketQueue;
+
+/* Keyframe positions of the video stream, collected on a background thread so seeks land
+   exactly on a keyframe even in containers without an index of their own */
+typedef struct KeyframeIndex
+{
+    std::mutex lock;
+    /* Sorted by pts, in stream time base */
+    vector<int64_t> pts;
+    vector<int64_t> pos;
+    bool complete = false;
+    std::atomic<bool> stop{false};
+    std::thread thread;
+}TKeyframeIndex;
+
+/* Scaler cached for the last input it was configured for */
+typedef struct CachedScaler
+{
+    SwsContext* sws = nullptr;
+    int width = 0;
+    int height = 0;
+    int format = AV_PIX_FMT_NONE;
+    enum AVColorRange range = AVCOL_RANGE_UNSPECIFIED;
+}TCachedScaler;
+
+/* Per-frame conversion state, sized once from the content dimensions. All working
+   buffers are carved out of a single arena so converting a frame never allocates */
+typedef struct ConvertContext
+{
+    int cols;
+    int rows;
+    int tile_w;
+    int tile_h;
+    TileRowKernel tile_kernel;
+    const char* kernel_name;
+    EConvertMode mode;
+
+    uint8_t* arena = nullptr;
+    uint16_t* tile_sums = nullptr;
+    char* lut_limited = nullptr;
+    char* lut_full = nullptr;
+    char* lut_gray = nullptr;
+    uint8_t* gray = nullptr;
+    int gray_linesize = 0;
+    /* Sobel column accumulators for edge glyphs, 4 * cols * tile_w entries */
+    int32_t* edge_columns = nullptr;
+    int edge_threshold = 0;
+
+    /* Shape matching, quadrant sums are tile sums of half the tile size */
+    EGlyphMode glyph_mode;
+    TileRowKernel quadrant_kernel = nullptr;
+    uint8_t* level_limited = nullptr;
+    uint8_t* level_full = nullptr;
+    /* Scaler path, one sample per quadrant at twice the grid size */
+    uint8_t* level_gray = nullptr;
+    char* shape_lut = nullptr;
+    /* cols * rows characters, row by row, followed by a terminating NUL */
+    char* ascii = nullptr;
+
+    /* Scaler path, any pixel format to full range gray at grid size */
+    TCachedScaler gray_scaler;
+
+    /* Color mode, one RGBA color per cell averaged by the scaler */
+    bool color = false;
+    TCachedScaler color_scaler;
+    uint8_t* colors = nullptr;
+    int colors_linesize = 0;
+}TConvertCtx;
+
+/* Presentation schedule: frame timestamps mapped onto a monotonic clock anchored at the first shown frame */
+typedef struct PresentClock
+{
+    bool started = false;
+    int64_t start_pts = 0;
+    int64_t last_pts = AV_NOPTS_VALUE;
+    std::chrono::steady_clock::time_point start_time;
+    AVRational time_base;
+    /* Nominal frame duration, used for frames without timestamp and as the lateness limit */
+    std::chrono::microseconds frame_duration;
+
+    size_t presented = 0;
+    size_t dropped = 0;
+    double drift_sum_ms = 0;
+    double drift_max_ms = 0;
+}TPresentClock;
+
+/* Per-frame stage timings collected in benchmark mode, in milliseconds */
+typedef struct BenchStats
+{
+    vector<double> decode_ms;
+    vector<double> convert_ms;
+    vector<double> render_ms;
+}TBenchStats;
+
+typedef struct PlayerOptions
+{
+    char* file = nullptr;
+    const char* ramp;
+    int ramp_len;
+    int frame_queue_depth;
+    EOutputMode output_mode;
+    ERenderMode render_mode;
+    bool bench;
+    int decoder_threads;
+    int decoder_thread_type;
+    bool fast_decode;
+    EInputMode input_mode;
+    EConvertMode convert_mode;
+    int tile_width;
+    int tile_height;
+    int edge_threshold;
+    EGlyphMode glyph_mode;
+    bool color;
+    bool full_redraw;
+    double start;
+    bool font_cache;
+    /* nullptr picks the per-user cache directory */
+    const char* font_cache_dir;
+}TPlayerOptions;
+
 /* We keep additional cpaces at the end for cases when rounding results in a larger value */
 static const char characters[] = "$@B%8&WM#*oahkbdpqwmZO0QLCJUYXzcvunxrjft/\\|()1{}[]?-_+~<>i!lI;:,\"^`'.   ";
 static const char* font_name = "SpaceMono-Regular.ttf";
-static const int tile_size = 4;
+static const int default_tile_size = 4;
 static const int font_size = 9;
-static const int ms_per_sec = 1000;
-static const int color_range_full = 256;
-static const int color_range_lim = 220;
-static const int color_range_lim_offs = 16;
+static const int us_per_sec = 1000000;
+/* Used when the stream does not signal a frame rate */
+static const AVRational fallback_frame_rate = {25, 1};
 static const float win_height_modifier = 1.77;
-static const float div_full = color_range_full / (float)(sizeof(characters) - 3);
-static const float div_limited = color_range_lim / (float)(sizeof(characters) - 3);
+/* The last padding space only catches rounding overflow, it is not a ramp step of its own */
+static const int characters_len = sizeof(characters) - 2;
 static const float line_height_mult = 1.75;
+static const int default_frame_queue_depth = 8;
+static const int max_frame_queue_depth = 128;
+/* Compressed packets are small, buffer enough to ride out read stalls */
+static const int packet_queue_depth = 64;
+/* Nominal rates above this are timestamp resolutions (1000/1, 90000/1 in VFR, MKV or TS), not frame rates */
+static const int max_frame_rate = 240;
+/* A frame due further ahead than this follows a timestamp jump, the clock is re-anchored on it
+   instead of blocking the render thread (and its event handling) until then */
+static const std::chrono::milliseconds max_present_wait(1000);
+/* Same for frames due this far in the past */
+static const std::chrono::seconds max_present_lag(10);
+/* A late frame shown because the next one isn't due yet re-anchors the clock once it is this late,
+   so a decoder slower than real time plays slowly instead of piling up lateness */
+static const std::chrono::milliseconds present_resync_threshold(100);
+/* Arrow keys seek by these amounts, left/right and down/up */
+static const int seek_step_short = 10;
+static const int seek_step_long = 60;
+/* FFmpeg warns above this many decoder threads */
+static const int max_decoder_threads = 16;
+/* Every buffer in the conversion arena starts on a cache line */
+static const size_t arena_alignment = 64;
+/* Largest sqrt(gx * gx + gy * gy) a 3x3 Sobel window reaches on 8-bit samples. Each axis alone
+   peaks at 4 * 255 = 1020, but then the other is at most 510, as for 0 0 0 / 0 . 255 / 255 255 255.
+   Tiles are compared by their mean magnitude, which cannot exceed the per-pixel one */
+static const int max_edge_threshold = 1140;
+
+/* Set from the signal handler, there is no SDL window to deliver SDL_QUIT in terminal mode */
+static volatile sig_atomic_t interrupted = 0;
+
+static void handle_interrupt(int)
+{
+    interrupted = 1;
+}
+
+/**
+ * @brief Prints command line help
+ */
+static void print_usage(void)
+{
+    cout
+        << "Usage: ascii_player [options] <file>" << endl
+        << "Options:" << endl
+        << "  --queue-depth <n>   number of decoded frames buffered ahead of rendering (1-" << max_frame_queue_depth
+                                    << ", default " << default_frame_queue_depth << ")" << endl
+        << "  --ramp <chars>      printable ASCII characters ordered from darkest to brightest luma" << endl
+        << "  --output <sink>     sdl: render into a window (default)" << endl
+        << "                      term: write changed cells to stdout as ANSI escape sequences, no window" << endl
+        << "  --threads <n>       decoder threads, 0 picks one per CPU core (default 0, max " << max_decoder_threads << ")" << endl
+        << "  --thread-type <t>   decoder threading: frame, slice or both (default both)" << endl
+        << "  --fast-decode       decode at reduced resolution and skip the loop filter where the codec allows it" << endl
+        << "  --input <mode>      readahead: read large chunks ahead of the demuxer on a thread (default)" << endl
+        << "                      mmap: map the file into memory" << endl
+        << "                      file: ffmpeg's own file I/O, also used when the input is not a regular file" << endl
+        << "  --convert <mode>    auto: tile kernels on 8-bit luma planes, swscale otherwise (default)" << endl
+        << "                      tiles: always sum tiles of the first plane" << endl
+        << "                      swscale: always scale to gray at grid size" << endl
+        << "  --tile <w>[x<h>]    pixels averaged per character, 1, 2, 4, 8 or 16 each (default "
+                                    << default_tile_size << "x" << default_tile_size << ")" << endl
+        << "  --edges <n>         draw | - / \\ on tiles whose mean Sobel magnitude exceeds n (1.." << max_edge_threshold
+                                    << "), luma tiles only" << endl
+        << "  --glyphs <mode>     luma: pick characters from the ramp by tile brightness (default)" << endl
+        << "                      shape: pick the ramp glyph whose 2x2 ink coverage best matches the tile, sdl output only" << endl
+        << "  --color             draw every character in the average color of its tile" << endl
+        << "  --full-redraw       redraw every row each frame instead of only the rows that changed" << endl
+        << "  --start <time>      start playback at seconds or [hh:]mm:ss" << endl
+        << "  --font-cache <dir>  keep rasterized glyph atlases in dir (default $XDG_CACHE_HOME/ascii_player)" << endl
+        << "  --no-font-cache     rasterize the font on every start" << endl
+        << "  --bench             play as fast as possible and report throughput and per-stage latency" << endl
+        << "  --render <mode>     geometry: batched glyph quads (default)" << endl
+        << "                      composite: glyph bitmaps copied into one streaming texture on the CPU" << endl
+        << "Controls (sdl output):" << endl
+        << "  left/right          seek " << seek_step_short << " seconds back/forward" << endl
+        << "  down/up             seek " << seek_step_long << " seconds back/forward" << endl
+        << "  mouse drag          scrub, the window width spans the whole video" << endl
+        << "  q/escape            quit" << endl
+        << flush;
+}
+
+/**
+ * @brief Parses a time given as seconds or as [hh:]mm:ss
+ * 
+ * @param text time to parse
+ * @param seconds receives the time in seconds
+ * @return int 0 or error code
+ */
+static int parse_time(const char* text, double* seconds)
+{
+    char* end = nullptr;
+
+    *seconds = 0;
+    for (int field = 0; field < 3; field++)
+    {
+        *seconds = *seconds * 60 + strtod(text, &end);
+        if (end == text || *seconds < 0)
+        {
+            return 1;
+        }
+        if (*end != ':')
+        {
+            break;
+        }
+        text = end + 1;
+    }
+
+    return (*end == '\0') ? 0 : 1;
+}
+
+/**
+ * @brief Parses command line arguments into player options
+ * 
+ * @param argc argument count
+ * @param argv argument values
+ * @param options pointer to options to fill
+ * @return int 0 or error code
+ */
+static int parse_options(int argc, char *argv[], TPlayerOptions* options)
+{
+    options->frame_queue_depth = default_frame_queue_depth;
+    options->ramp = characters;
+    options->ramp_len = characters_len;
+    options->output_mode = OUTPUT_SDL;
+    options->render_mode = RENDER_GEOMETRY;
+    options->bench = false;
+    options->decoder_threads = 0;
+    options->decoder_thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    options->fast_decode = false;
+    options->input_mode = INPUT_READAHEAD;
+    options->convert_mode = CONVERT_AUTO;
+    options->tile_width = default_tile_size;
+    options->tile_height = default_tile_size;
+    options->edge_threshold = 0;
+    options->glyph_mode = GLYPHS_LUMA;
+    options->color = false;
+    options->full_redraw = false;
+    options->start = 0;
+    options->font_cache = true;
+    options->font_cache_dir = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--queue-depth") == 0 && i + 1 < argc)
+        {
+            options->frame_queue_depth = atoi(argv[++i]);
+            if (options->frame_queue_depth < 1 || options->frame_queue_depth > max_frame_queue_depth)
+            {
+                std::cerr << "Invalid queue depth: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--ramp") == 0 && i + 1 < argc)
+        {
+            options->ramp = argv[++i];
+            options->ramp_len = strlen(options->ramp);
+            for (int c = 0; c < options->ramp_len; c++)
+            {
+                if (options->ramp[c] < ' ' || options->ramp[c] > '~')
+                {
+                    options->ramp_len = 0;
+                }
+            }
+            if (options->ramp_len < 2)
+            {
+                std::cerr << "Ramp needs at least two printable ASCII characters" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            options->decoder_threads = atoi(argv[++i]);
+            if (options->decoder_threads < 0 || options->decoder_threads > max_decoder_threads)
+            {
+                std::cerr << "Invalid thread count: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--thread-type") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "frame") == 0)
+            {
+                options->decoder_thread_type = FF_THREAD_FRAME;
+            }
+            else if (strcmp(argv[i], "slice") == 0)
+            {
+                options->decoder_thread_type = FF_THREAD_SLICE;
+            }
+            else if (strcmp(argv[i], "both") == 0)
+            {
+                options->decoder_thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            }
+            else
+            {
+                std::cerr << "Unknown thread type: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--fast-decode") == 0)
+        {
+            options->fast_decode = true;
+        }
+        else if (strcmp(argv[i], "--bench") == 0)
+        {
+            options->bench = true;
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "sdl") == 0)
+            {
+                options->output_mode = OUTPUT_SDL;
+            }
+            else if (strcmp(argv[i], "term") == 0)
+            {
+                options->output_mode = OUTPUT_TERM;
+            }
+            else
+            {
+                std::cerr << "Unknown output: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "geometry") == 0)
+            {
+                options->render_mode = RENDER_GEOMETRY;
+            }
+            else if (strcmp(argv[i], "composite") == 0)
+            {
+                options->render_mode = RENDER_COMPOSITE;
+            }
+            else
+            {
+                std::cerr << "Unknown render mode: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc)
+        {
+            /* A single number means a square tile */
+            char* end = nullptr;
+            options->tile_width = (int)strtol(argv[++i], &end, 10);
+            options->tile_height = (*end == 'x') ? (int)strtol(end + 1, &end, 10) : options->tile_width;
+            if (*end != '\0' || select_tile_row_kernel(options->tile_width, options->tile_height, nullptr) == nullptr)
+            {
+                std::cerr << "Unsupported tile size: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--edges") == 0 && i + 1 < argc)
+        {
+            options->edge_threshold = atoi(argv[++i]);
+            if (options->edge_threshold < 1 || options->edge_threshold > max_edge_threshold)
+            {
+                std::cerr << "Invalid edge threshold: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--full-redraw") == 0)
+        {
+            options->full_redraw = true;
+        }
+        else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc)
+        {
+            if (parse_time(argv[++i], &options->start))
+            {
+                std::cerr << "Invalid start time: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--font-cache") == 0 && i + 1 < argc)
+        {
+            options->font_cache = true;
+            options->font_cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-font-cache") == 0)
+        {
+            options->font_cache = false;
+        }
+        else if (strcmp(argv[i], "--color") == 0)
+        {
+            options->color = true;
+        }
+        else if (strcmp(argv[i], "--glyphs") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "luma") == 0)
+            {
+                options->glyph_mode = GLYPHS_LUMA;
+            }
+            else if (strcmp(argv[i], "shape") == 0)
+            {
+                options->glyph_mode = GLYPHS_SHAPE;
+            }
+            else
+            {
+                std::cerr << "Unknown glyph mode: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "readahead") == 0)
+            {
+                options->input_mode = INPUT_READAHEAD;
+            }
+            else if (strcmp(argv[i], "mmap") == 0)
+            {
+                options->input_mode = INPUT_MMAP;
+            }
+            else if (strcmp(argv[i], "file") == 0)
+            {
+                options->input_mode = INPUT_FILE;
+            }
+            else
+            {
+                std::cerr << "Unknown input mode: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--convert") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "auto") == 0)
+            {
+                options->convert_mode = CONVERT_AUTO;
+            }
+            else if (strcmp(argv[i], "tiles") == 0)
+            {
+                options->convert_mode = CONVERT_TILES;
+            }
+            else if (strcmp(argv[i], "swscale") == 0)
+            {
+                options->convert_mode = CONVERT_SWSCALE;
+            }
+            else
+            {
+                std::cerr << "Unknown convert mode: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (argv[i][0] == '-' && argv[i][1] == '-')
+        {
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+            return 1;
+        }
+        else
+        {
+            options->file = argv[i];
+        }
+    }
+
+    /* Glyph coverage comes from the font atlas and needs quadrants of at least one pixel */
+    if (options->glyph_mode == GLYPHS_SHAPE &&
+        (options->output_mode != OUTPUT_SDL || options->edge_threshold > 0 || options->tile_width < 2 || options->tile_height < 2))
+    {
+        std::cerr << "Shape glyphs need sdl output, no --edges and tiles of at least 2x2" << std::endl;
+        return 1;
+    }
+
+    return (options->file == nullptr) ? 1 : 0;
+}
 
 /**
  * @brief Initializes Ffmpeg and prepares to decode a video stream
  * 
  * @param ffmpegctx pointer to mpeg context
- * @param file_name video file name
+ * @param options pointer to player options (file name, decoder settings)
  * @return int 0 or error code
  */
-static int init_ffmpeg(TFfmpegCtx* ffmpegctx, char* file_name)
+static int init_ffmpeg(TFfmpegCtx* ffmpegctx, const TPlayerOptions* options)
 {
     int ret = 0;
 
-    ffmpegctx->file = file_name;
+    ffmpegctx->file = options->file;
     ffmpegctx->codec = nullptr;
     ffmpegctx->stream = nullptr;
     ffmpegctx->decframe = nullptr;
@@ -85,8 +680,23 @@ static int init_ffmpeg(TFfmpegCtx* ffmpegctx, char* file_name)
     ffmpegctx->end_of_stream = false;
     ffmpegctx->got_image = 0;
 
-    /* Open file context */
+    /* Open file context, reading through custom I/O so slow storage doesn't stall the demuxer */
     ffmpegctx->input_ctx = nullptr;
+    ffmpegctx->input.mode = INPUT_FILE;
+    if (options->input_mode != INPUT_FILE && media_input_open(&ffmpegctx->input, ffmpegctx->file, options->input_mode) == 0)
+    {
+        ffmpegctx->input_ctx = avformat_alloc_context();
+        if (!ffmpegctx->input_ctx)
+        {
+            std::cerr << "Error allocating format context" << std::endl;
+            return 1;
+        }
+        ffmpegctx->input_ctx->pb = ffmpegctx->input.avio;
+    }
+    else
+    {
+        ffmpegctx->input.mode = INPUT_FILE;
+    }
     if (avformat_open_input(&(ffmpegctx->input_ctx), ffmpegctx->file, nullptr, nullptr) < 0) 
     {
         std::cerr << "Avformat open error: " << ret;
@@ -110,6 +720,15 @@ static int init_ffmpeg(TFfmpegCtx* ffmpegctx, char* file_name)
     }
     
     ffmpegctx->stream = ffmpegctx->input_ctx->streams[ffmpegctx->stream_idx];
+
+    /* Audio, subtitles and other video streams are never played, so the demuxer needn't parse them */
+    for (unsigned int i = 0; i < ffmpegctx->input_ctx->nb_streams; i++)
+    {
+        if ((int)i != ffmpegctx->stream_idx)
+        {
+            ffmpegctx->input_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
     
     ffmpegctx->codec_ctx = avcodec_alloc_context3(ffmpegctx->codec);
     if (!ffmpegctx->codec_ctx) 
@@ -128,6 +747,29 @@ static int init_ffmpeg(TFfmpegCtx* ffmpegctx, char* file_name)
         return 1;
     }
 
+    /* Decoder threading, the decoder falls back to what the codec supports */
+    ffmpegctx->codec_ctx->thread_count = options->decoder_threads;
+    if (ffmpegctx->codec_ctx->thread_count == 0)
+    {
+        ffmpegctx->codec_ctx->thread_count = std::min<int>(std::max(1u, std::thread::hardware_concurrency()), max_decoder_threads);
+    }
+    ffmpegctx->codec_ctx->thread_type = options->decoder_thread_type;
+
+    /* Each character only keeps the average of a tile, so let the decoder downscale
+       by up to the tile edge and skip work that mostly sharpens detail we average away */
+    if (options->fast_decode)
+    {
+        const int tile_edge = std::min(options->tile_width, options->tile_height);
+        const int min_tile_edge = (options->glyph_mode == GLYPHS_SHAPE) ? 2 : 1;
+        while ((tile_edge >> (ffmpegctx->lowres + 1)) >= min_tile_edge && ffmpegctx->lowres < ffmpegctx->codec->max_lowres)
+        {
+            ffmpegctx->lowres++;
+        }
+        ffmpegctx->codec_ctx->lowres = ffmpegctx->lowres;
+        ffmpegctx->codec_ctx->skip_loop_filter = AVDISCARD_ALL;
+        ffmpegctx->codec_ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    }
+
     /* Open decoder context*/
     if (avcodec_open2(ffmpegctx->codec_ctx, ffmpegctx->codec, nullptr) < 0) 
     {
@@ -149,18 +791,95 @@ static int init_ffmpeg(TFfmpegCtx* ffmpegctx, char* file_name)
         << "length: " << av_rescale_q(ffmpegctx->stream->duration, ffmpegctx->stream->time_base, {1,1000}) / 1000. << " [sec]" << endl
         << "pixfmt: " << av_get_pix_fmt_name((AVPixelFormat)ffmpegctx->stream->codecpar->format) << endl
         << "frame:  " << ffmpegctx->stream->nb_frames << endl
+        << "threads: " << ffmpegctx->codec_ctx->thread_count << " ("
+            << ((ffmpegctx->codec_ctx->active_thread_type & FF_THREAD_FRAME) ? "frame" :
+                (ffmpegctx->codec_ctx->active_thread_type & FF_THREAD_SLICE) ? "slice" : "none") << ")" << endl
+        << "lowres: " << ffmpegctx->lowres << endl
+        << "input:  " << ((ffmpegctx->input.mode == INPUT_MMAP) ? "mmap" : (ffmpegctx->input.mode == INPUT_READAHEAD) ? "readahead" : "file") << endl
         << flush;
     
     return 0;
 }
 
+/**
+ * @brief Points the font cache at the directory for rasterized glyph atlases, creating it if needed
+ * 
+ * @param options pointer to player options
+ */
+static void init_font_cache(const TPlayerOptions* options)
+{
+    std::string dir;
+
+    if (!options->font_cache)
+    {
+        return;
+    }
+
+    if (options->font_cache_dir)
+    {
+        dir = options->font_cache_dir;
+    }
+    else
+    {
+        const char* xdg_cache = getenv("XDG_CACHE_HOME");
+        const char* home = getenv("HOME");
+        if (xdg_cache && *xdg_cache)
+        {
+            dir = std::string(xdg_cache) + "/ascii_player";
+        }
+        else if (home && *home)
+        {
+            dir = std::string(home) + "/.cache";
+            mkdir(dir.c_str(), 0755);
+            dir += "/ascii_player";
+        }
+        else
+        {
+            return;
+        }
+    }
+
+    /* An existing directory is fine, one we can't create just means atlases aren't saved */
+    mkdir(dir.c_str(), 0755);
+    FC_SetAtlasCacheDir(dir.c_str());
+}
+
+/**
+ * @brief Collects the characters frames can contain, so only those get rasterized into the font atlas
+ * 
+ * @param options pointer to player options
+ * @return std::string every character once, space first since cell sizes are taken from it
+ */
+static std::string make_glyph_set(const TPlayerOptions* options)
+{
+    std::string glyphs = " ";
+    std::string candidates(options->ramp, options->ramp_len);
+
+    if (options->edge_threshold > 0)
+    {
+        candidates += EDGE_GLYPHS;
+    }
+
+    for (char c : candidates)
+    {
+        if (glyphs.find(c) == std::string::npos)
+        {
+            glyphs += c;
+        }
+    }
+
+    return glyphs;
+}
+
 /**
  * @brief Initializes SDL, creates render, window and caches font
  * 
  * @param sdlctx pointer to SDL context
+ * @param vsync true to sync presentation to the display refresh
+ * @param glyphs characters to rasterize up front
  * @return int 0 or error code
  */
-static int init_sdl(TSDLContext *sdlctx)
+static int init_sdl(TSDLContext *sdlctx, bool vsync, const char* glyphs)
 {
     sdlctx->window = SDL_CreateWindow("", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT, SDL_WINDOW_SHOWN);
     if(sdlctx->window == NULL)
@@ -169,7 +888,7 @@ static int init_sdl(TSDLContext *sdlctx)
         return 2;
     }
 
-    sdlctx->renderer = SDL_CreateRenderer(sdlctx->window, -1, SDL_RENDERER_PRESENTVSYNC);
+    sdlctx->renderer = SDL_CreateRenderer(sdlctx->window, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
     if(sdlctx->renderer == NULL)
     {
         SDL_Log("Failed to create renderer.\n");
@@ -177,6 +896,7 @@ static int init_sdl(TSDLContext *sdlctx)
     }
     
     sdlctx->fc_font = FC_CreateFont();  
+    FC_SetLoadingString(sdlctx->fc_font, glyphs);
     FC_LoadFont(sdlctx->fc_font, sdlctx->renderer, font_name, font_size, FC_MakeColor(255,255,255,255), TTF_STYLE_NORMAL);
                   
     return 0;
@@ -197,6 +917,11 @@ static void cleanup(int exitcode, TSDLContext *sdlctx, TFfmpegCtx* ffmpegctx)
         av_frame_free(&(ffmpegctx->decframe));
     }
 
+    if (ffmpegctx->pkt)
+    {
+        av_packet_free(&(ffmpegctx->pkt));
+    }
+
     if (ffmpegctx->codec_ctx)
     {
         avcodec_close(ffmpegctx->codec_ctx);
@@ -207,7 +932,20 @@ static void cleanup(int exitcode, TSDLContext *sdlctx, TFfmpegCtx* ffmpegctx)
         avformat_close_input(&(ffmpegctx->input_ctx));
     }
 
+    /* Custom I/O outlives the format context */
+    media_input_close(&ffmpegctx->input);
+
     /* De-init SDL */
+    if (sdlctx->composite.texture)
+    {
+        SDL_DestroyTexture(sdlctx->composite.texture);
+    }
+
+    if (sdlctx->delta.canvas)
+    {
+        SDL_DestroyTexture(sdlctx->delta.canvas);
+    }
+
     if (sdlctx->fc_font)
     {
         FC_FreeFont(sdlctx->fc_font);
@@ -222,12 +960,13 @@ static void cleanup(int exitcode, TSDLContext *sdlctx, TFfmpegCtx* ffmpegctx)
  * 
  * @param fc_font pointer to cached SDL Font 
  * @param stream Pointer to Ffmpeg video stream info
+ * @param tile_width pixels per character column
  * @param window pointer to SDL window descriptor
  */
-static void update_window_size(FC_Font* fc_font, AVStream* stream, SDL_Window *window)
+static void update_window_size(FC_Font* fc_font, AVStream* stream, int tile_width, SDL_Window *window)
 {
     const int winheight = (stream->codecpar->height) * win_height_modifier;
-    const int winwidth = (stream->codecpar->width / tile_size) * FC_GetWidth(fc_font, "%s", "c");
+    const int winwidth = (stream->codecpar->width / tile_width) * FC_GetTextWidth(fc_font, "c", 1);
     if (winwidth != WIDTH || winheight!= HEIGHT)
     {
         SDL_SetWindowSize(window, winwidth, winheight);
@@ -235,209 +974,2117 @@ static void update_window_size(FC_Font* fc_font, AVStream* stream, SDL_Window *w
 }
 
 /**
- * @brief Attempts to decode next frame using Ffmpeg library
+ * @brief Finds the first glyph row of a one line high cell, so the cell keeps the
+ *          vertical window where the ramp actually has ink
  * 
- * @param ffmpegctx pointer to ffmpeg context
- * @return int 0 or error code
+ * @param fc_font pointer to cached SDL Font
+ * @param ramp characters that can appear in a frame
+ * @param ramp_len number of characters in ramp
+ * @param cell_h cell height in pixels
+ * @return int row offset into the glyph rectangles
  */
-static int get_frame(TFfmpegCtx* ffmpegctx)
+static int find_ramp_ink_offset(FC_Font* fc_font, const char* ramp, int ramp_len, int cell_h)
 {
-    int ret = 0;
-
-    /* Read next packet */
-    if (!ffmpegctx->end_of_stream) 
+    FC_GlyphData glyph;
+    if (!FC_GetGlyphData(fc_font, &glyph, ' '))
     {
-        ret = av_read_frame(ffmpegctx->input_ctx, ffmpegctx->pkt);
-        if (ret < 0 && ret != AVERROR_EOF) 
+        return 0;
+    }
+
+    int ink_top = glyph.rect.h;
+    int ink_bottom = -1;
+    for (int i = 0; i < ramp_len; i++)
+    {
+        SDL_Surface* atlas;
+        if (!FC_GetGlyphData(fc_font, &glyph, (unsigned char)ramp[i]) ||
+            !(atlas = FC_GetGlyphCacheSurface(fc_font, glyph.cache_level)))
+        {
+            continue;
+        }
+
+        SDL_LockSurface(atlas);
+        for (int y = 0; y < glyph.rect.h; y++)
+        {
+            const uint32_t* line = (const uint32_t*)((const uint8_t*)atlas->pixels + (glyph.rect.y + y) * atlas->pitch) + glyph.rect.x;
+            for (int x = 0; x < glyph.rect.w; x++)
+            {
+                Uint8 r, g, b, a;
+                SDL_GetRGBA(line[x], atlas->format, &r, &g, &b, &a);
+                if (a)
+                {
+                    ink_top = std::min(ink_top, y);
+                    ink_bottom = std::max(ink_bottom, y);
+                }
+            }
+        }
+        SDL_UnlockSurface(atlas);
+    }
+
+    return (ink_bottom < ink_top) ? 0 : std::max(0, (ink_top + ink_bottom + 1 - cell_h) / 2);
+}
+
+/**
+ * @brief Measures the 2x2 quadrant ink coverage of every ramp glyph in the font atlas
+ *          and builds the shape matching table from it. Cells are cropped the same way
+ *          the composite renderer crops them
+ * 
+ * @param convctx pointer to conversion context
+ * @param fc_font pointer to cached SDL Font
+ * @param line_height rendered line height in pixels
+ * @param ramp candidate characters
+ * @param ramp_len number of characters in ramp
+ * @return int 0 or error code
+ */
+static int init_shape_glyphs(TConvertCtx* convctx, FC_Font* fc_font, float line_height, const char* ramp, int ramp_len)
+{
+    FC_GlyphData glyph;
+    if (!FC_GetGlyphData(fc_font, &glyph, ' '))
+    {
+        SDL_Log("Failed to get glyph cell size.\n");
+        return 1;
+    }
+
+    const int cell_w = glyph.rect.w;
+    const int cell_h = std::max(1, (int)lround(line_height));
+    const int offset = find_ramp_ink_offset(fc_font, ramp, ramp_len, cell_h);
+    const int half_w = std::max(1, cell_w / 2);
+    const int half_h = std::max(1, cell_h / 2);
+
+    TGlyphCoverage glyphs;
+    glyphs.count = 0;
+    int coverage[SHAPE_QUADRANTS][256] = {{0}};
+    int max_coverage = 1;
+    bool seen[256] = {false};
+
+    for (int i = 0; i < ramp_len; i++)
+    {
+        /* A luma ramp may repeat characters to weight them, shape matching needs each glyph once.
+           That also keeps the count within the 256 entry tables */
+        if (seen[(unsigned char)ramp[i]])
+        {
+            continue;
+        }
+        seen[(unsigned char)ramp[i]] = true;
+
+        const int index = glyphs.count++;
+        glyphs.glyphs[index] = ramp[i];
+
+        SDL_Surface* atlas;
+        if (!FC_GetGlyphData(fc_font, &glyph, (unsigned char)ramp[i]) ||
+            !(atlas = FC_GetGlyphCacheSurface(fc_font, glyph.cache_level)))
+        {
+            /* Blank glyph, no ink anywhere */
+            continue;
+        }
+
+        /* Sum alpha per quadrant, normalized by quadrant area */
+        int ink[SHAPE_QUADRANTS] = {0};
+        SDL_LockSurface(atlas);
+        for (int y = 0; y < cell_h && offset + y < glyph.rect.h; y++)
+        {
+            const uint32_t* line = (const uint32_t*)((const uint8_t*)atlas->pixels + (glyph.rect.y + offset + y) * atlas->pitch) + glyph.rect.x;
+            for (int x = 0; x < cell_w && x < glyph.rect.w; x++)
+            {
+                Uint8 r, g, b, a;
+                SDL_GetRGBA(line[x], atlas->format, &r, &g, &b, &a);
+                ink[((y >= half_h) ? 2 : 0) + ((x >= half_w) ? 1 : 0)] += a;
+            }
+        }
+        SDL_UnlockSurface(atlas);
+
+        const int areas[SHAPE_QUADRANTS] = {half_w * half_h, (cell_w - half_w) * half_h,
+                                            half_w * (cell_h - half_h), (cell_w - half_w) * (cell_h - half_h)};
+        for (int quadrant = 0; quadrant < SHAPE_QUADRANTS; quadrant++)
+        {
+            coverage[quadrant][index] = ink[quadrant] / std::max(1, areas[quadrant]);
+            max_coverage = std::max(max_coverage, coverage[quadrant][index]);
+        }
+    }
+
+    /* Even the densest glyph covers only part of its cell, stretch so it reads as full ink */
+    for (int quadrant = 0; quadrant < SHAPE_QUADRANTS; quadrant++)
+    {
+        for (int index = 0; index < glyphs.count; index++)
+        {
+            glyphs.coverage[quadrant][index] = (uint8_t)(coverage[quadrant][index] * 255 / max_coverage);
+        }
+    }
+
+    build_shape_lut(convctx->shape_lut, &glyphs);
+
+    return 0;
+}
+
+/**
+ * @brief Prerasterizes the glyphs frames can contain into fixed size cells and creates the streaming texture for
+ *          composite rendering. Cells are one glyph advance wide and one line high, glyphs taller than a line are
+ *          cropped around the rows where the glyphs actually have ink
+ * 
+ * @param sdlctx pointer to SDL context
+ * @param glyphs characters that can appear in a frame, see make_glyph_set()
+ * @param glyphs_len number of characters in glyphs
+ * @param cols number of character columns
+ * @param rows number of character rows
+ * @return int 0 or error code
+ */
+static int init_composite(TSDLContext* sdlctx, const char* glyphs, int glyphs_len, int cols, int rows)
+{
+    TCompositeCtx* comp = &sdlctx->composite;
+    const SDL_Color color = FC_GetDefaultColor(sdlctx->fc_font);
+    FC_GlyphData glyph;
+
+    if (!FC_GetGlyphData(sdlctx->fc_font, &glyph, ' '))
+    {
+        SDL_Log("Failed to get glyph cell size.\n");
+        return 1;
+    }
+    comp->cell_w = glyph.rect.w;
+    comp->cell_h = std::max(1, (int)lround(sdlctx->line_height));
+    const int offset = find_ramp_ink_offset(sdlctx->fc_font, glyphs, glyphs_len, comp->cell_h);
+
+    /* Bake every glyph on black, so cells can be copied without blending */
+    const int cell_pixels = comp->cell_w * comp->cell_h;
+    comp->glyph_cells.assign(256 * cell_pixels, 0xFF000000);
+    for (int i = 0; i < glyphs_len; i++)
+    {
+        SDL_Surface* atlas;
+        if (!FC_GetGlyphData(sdlctx->fc_font, &glyph, (unsigned char)glyphs[i]) ||
+            !(atlas = FC_GetGlyphCacheSurface(sdlctx->fc_font, glyph.cache_level)))
+        {
+            continue;
+        }
+
+        uint32_t* cell = &comp->glyph_cells[(unsigned char)glyphs[i] * cell_pixels];
+        SDL_LockSurface(atlas);
+        for (int y = 0; y < comp->cell_h && offset + y < glyph.rect.h; y++)
+        {
+            const uint32_t* line = (const uint32_t*)((const uint8_t*)atlas->pixels + (glyph.rect.y + offset + y) * atlas->pitch) + glyph.rect.x;
+            for (int x = 0; x < comp->cell_w && x < glyph.rect.w; x++)
+            {
+                Uint8 r, g, b, a;
+                SDL_GetRGBA(line[x], atlas->format, &r, &g, &b, &a);
+                cell[y * comp->cell_w + x] = 0xFF000000 | ((color.r * a / 255) << 16) | ((color.g * a / 255) << 8) | (color.b * a / 255);
+            }
+        }
+        SDL_UnlockSurface(atlas);
+    }
+
+    comp->pixels.resize(cols * rows * cell_pixels);
+    comp->texture = SDL_CreateTexture(sdlctx->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                        cols * comp->cell_w, rows * comp->cell_h);
+    if (comp->texture == NULL)
+    {
+        SDL_Log("Failed to create composite texture.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Copies the glyph cell of every character into the frame and uploads it
+ * 
+ * @param comp pointer to composite context
+ * @param ascii_buffer characters of the frame, row by row
+ * @param cols number of character columns
+ * @param rows number of character rows
+ * @param colors optional cell colors, 4 bytes (R, G, B, A) per cell, NULL to keep the font color
+ * @param colors_linesize distance between two rows of colors in bytes
+ * @param dirty optional per row flags, only flagged rows are composited and uploaded. NULL for all rows
+ */
+static void composite_frame(TCompositeCtx* comp, const char* ascii_buffer, int cols, int rows, const uint8_t* colors, int colors_linesize,
+                            const uint8_t* dirty)
+{
+    const int cell_pixels = comp->cell_w * comp->cell_h;
+    const size_t cell_line_bytes = comp->cell_w * sizeof(uint32_t);
+    const size_t row_pixels = (size_t)cols * cell_pixels;
+    int first_dirty = rows;
+    int last_dirty = -1;
+
+    for (int row = 0; row < rows; row++)
+    {
+        if (dirty && !dirty[row])
+        {
+            continue;
+        }
+        first_dirty = std::min(first_dirty, row);
+        last_dirty = row;
+
+        uint32_t* dst = &comp->pixels[row * row_pixels];
+        const unsigned char* line = (const unsigned char*)&ascii_buffer[row * cols];
+        for (int y = 0; y < comp->cell_h; y++)
+        {
+            for (int col = 0; col < cols; col++, dst += comp->cell_w)
+            {
+                const uint32_t* src = &comp->glyph_cells[line[col] * cell_pixels + y * comp->cell_w];
+                if (colors == nullptr)
+                {
+                    memcpy(dst, src, cell_line_bytes);
+                    continue;
+                }
+
+                /* Modulate the baked glyph by the cell color */
+                const uint8_t* color = &colors[row * colors_linesize + col * 4];
+                for (int x = 0; x < comp->cell_w; x++)
+                {
+                    const uint32_t pixel = src[x];
+                    dst[x] = 0xFF000000 | ((((pixel >> 16) & 0xFF) * color[0] + 0xFF) >> 8) << 16
+                                        | ((((pixel >> 8) & 0xFF) * color[1] + 0xFF) >> 8) << 8
+                                        | (((pixel & 0xFF) * color[2] + 0xFF) >> 8);
+                }
+            }
+        }
+    }
+
+    /* One upload covering every changed row */
+    if (last_dirty >= 0)
+    {
+        const SDL_Rect rect = {0, first_dirty * comp->cell_h, cols * comp->cell_w, (last_dirty - first_dirty + 1) * comp->cell_h};
+        SDL_UpdateTexture(comp->texture, &rect, &comp->pixels[first_dirty * row_pixels], cols * cell_line_bytes);
+    }
+}
+
+/**
+ * @brief Prepares delta rendering: keeps the previous grid and, for the geometry renderer,
+ *          a target texture the unchanged rows persist in between frames
+ * 
+ * @param sdlctx pointer to SDL context
+ * @param cols number of character columns
+ * @param rows number of character rows
+ * @param enabled false to redraw every row each frame
+ */
+static void init_delta(TSDLContext* sdlctx, int cols, int rows, bool enabled)
+{
+    TDeltaCtx* delta = &sdlctx->delta;
+    FC_GlyphData glyph;
+
+    delta->enabled = enabled;
+    delta->valid = false;
+    delta->prev.assign(cols * rows, '\0');
+    delta->prev_colors.assign(cols * rows * 4, 0);
+    delta->dirty.assign(rows, 1);
+
+    if (!enabled || sdlctx->render_mode != RENDER_GEOMETRY)
+    {
+        return;
+    }
+
+    delta->cell_w = FC_GetGlyphData(sdlctx->fc_font, &glyph, ' ') ? glyph.rect.w : 0;
+    delta->glyph_h = FC_GetLineHeight(sdlctx->fc_font);
+    const int canvas_h = (int)ceilf((rows - 1) * sdlctx->line_height) + delta->glyph_h;
+
+    if (SDL_RenderTargetSupported(sdlctx->renderer) && delta->cell_w > 0)
+    {
+        delta->canvas = SDL_CreateTexture(sdlctx->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, cols * delta->cell_w, canvas_h);
+    }
+
+    if (delta->canvas == NULL)
+    {
+        /* Without a persistent target every row has to be drawn each frame */
+        SDL_Log("Render targets unavailable, redrawing full frames.\n");
+        delta->enabled = false;
+        return;
+    }
+    SDL_SetTextureBlendMode(delta->canvas, SDL_BLENDMODE_NONE);
+}
+
+/**
+ * @brief Flags the rows whose characters or colors differ from the previous frame and remembers the new frame
+ * 
+ * @param delta pointer to delta context
+ * @param ascii_buffer characters of the frame, row by row
+ * @param cols number of character columns
+ * @param rows number of character rows
+ * @param colors optional cell colors, 4 bytes (R, G, B, A) per cell
+ * @param colors_linesize distance between two rows of colors in bytes
+ * @return int number of changed rows
+ */
+static int find_dirty_rows(TDeltaCtx* delta, const char* ascii_buffer, int cols, int rows, const uint8_t* colors, int colors_linesize)
+{
+    int changed = 0;
+
+    for (int row = 0; row < rows; row++)
+    {
+        const char* line = &ascii_buffer[row * cols];
+        char* prev = &delta->prev[row * cols];
+        bool dirty = !delta->valid || memcmp(line, prev, cols) != 0;
+        if (dirty)
+        {
+            memcpy(prev, line, cols);
+        }
+
+        if (colors)
+        {
+            const uint8_t* line_colors = &colors[row * colors_linesize];
+            uint8_t* prev_colors = &delta->prev_colors[row * cols * 4];
+            if (!delta->valid || memcmp(line_colors, prev_colors, cols * 4) != 0)
+            {
+                memcpy(prev_colors, line_colors, cols * 4);
+                dirty = true;
+            }
+        }
+
+        delta->dirty[row] = dirty;
+        changed += dirty;
+    }
+
+    return changed;
+}
+
+/**
+ * @brief Redraws the changed rows into the persistent canvas. Glyphs are taller than a line,
+ *          so each run of changed rows becomes a band covering everything their glyphs touch;
+ *          the band is cleared and every row reaching into it is redrawn clipped to it
+ * 
+ * @param sdlctx pointer to SDL context
+ * @param ascii_buffer characters of the frame, row by row
+ * @param cols number of character columns
+ * @param rows number of character rows
+ * @param colors optional cell colors, 4 bytes (R, G, B, A) per cell
+ * @param colors_linesize distance between two rows of colors in bytes
+ */
+static void draw_dirty_rows(TSDLContext* sdlctx, const char* ascii_buffer, int cols, int rows, const uint8_t* colors, int colors_linesize)
+{
+    TDeltaCtx* delta = &sdlctx->delta;
+    const float line_height = sdlctx->line_height;
+    const int color_pitch = colors_linesize / (int)sizeof(SDL_Color);
+    int row = 0;
+
+    SDL_SetRenderTarget(sdlctx->renderer, delta->canvas);
+    SDL_SetRenderDrawColor(sdlctx->renderer, 0x00, 0x00, 0x00, 0xFF);
+
+    while (row < rows)
+    {
+        if (!delta->dirty[row])
+        {
+            row++;
+            continue;
+        }
+
+        /* Grow the band while the next changed row starts inside it */
+        int last = row;
+        float band_bottom = row * line_height + delta->glyph_h;
+        for (int next = row + 1; next < rows && next * line_height < band_bottom; next++)
+        {
+            if (delta->dirty[next])
+            {
+                last = next;
+                band_bottom = next * line_height + delta->glyph_h;
+            }
+        }
+        const float band_top = row * line_height;
+
+        /* Unchanged neighbours whose glyphs reach into the band */
+        int first_draw = row;
+        while (first_draw > 0 && (first_draw - 1) * line_height + delta->glyph_h > band_top)
+        {
+            first_draw--;
+        }
+        int last_draw = last;
+        while (last_draw + 1 < rows && (last_draw + 1) * line_height < band_bottom)
+        {
+            last_draw++;
+        }
+
+        const SDL_Rect clip = {0, (int)floorf(band_top), cols * delta->cell_w, (int)ceilf(band_bottom) - (int)floorf(band_top)};
+        SDL_RenderSetClipRect(sdlctx->renderer, &clip);
+        SDL_RenderFillRect(sdlctx->renderer, &clip);
+        FC_DrawGridColors(sdlctx->fc_font, sdlctx->renderer, 0, first_draw * line_height, line_height,
+                          (const Uint8*)&ascii_buffer[first_draw * cols], cols, last_draw - first_draw + 1, cols,
+                          colors ? (const SDL_Color*)&colors[first_draw * colors_linesize] : nullptr, color_pitch);
+
+        row = last + 1;
+    }
+
+    SDL_RenderSetClipRect(sdlctx->renderer, nullptr);
+    SDL_SetRenderTarget(sdlctx->renderer, nullptr);
+}
+
+/**
+ * @brief Allocates packet slots of the demuxed packet ring
+ * 
+ * @param queue pointer to packet queue
+ * @param depth number of packets that can be buffered
+ * @return int 0 or error code
+ */
+static int packet_queue_init(TPacketQueue* queue, int depth)
+{
+    queue->packets.resize(depth, nullptr);
+    for (auto& packet : queue->packets)
+    {
+        packet = av_packet_alloc();
+        if (!packet)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Releases all packet slots of the demuxed packet ring
+ * 
+ * @param queue pointer to packet queue
+ */
+static void packet_queue_destroy(TPacketQueue* queue)
+{
+    for (auto& packet : queue->packets)
+    {
+        av_packet_free(&packet);
+    }
+    queue->packets.clear();
+}
+
+/**
+ * @brief Waits for a free slot or a seek request, called by the demux thread.
+ *          After end of file only a seek or abort wakes it up
+ * 
+ * @param queue pointer to packet queue
+ * @param seek set to true when a seek was requested instead
+ * @param seek_target receives the requested position in stream time base
+ * @return AVPacket* slot to read the next packet into or nullptr on seek or if playback was aborted
+ */
+static AVPacket* packet_queue_peek_writable(TPacketQueue* queue, bool* seek, int64_t* seek_target)
+{
+    std::unique_lock<std::mutex> lock(queue->lock);
+    queue->cond.wait(lock, [queue] { return (queue->size < queue->packets.size() && !queue->finished) || queue->seek_req || queue->abort; });
+
+    *seek = queue->seek_req && !queue->abort;
+    if (*seek)
+    {
+        *seek_target = queue->seek_target;
+        queue->seek_req = false;
+    }
+
+    return (queue->abort || *seek) ? nullptr : queue->packets[queue->windex];
+}
+
+/**
+ * @brief Publishes the slot returned by packet_queue_peek_writable() to the decoder
+ * 
+ * @param queue pointer to packet queue
+ */
+static void packet_queue_push(TPacketQueue* queue)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    queue->windex = (queue->windex + 1) % queue->packets.size();
+    queue->size++;
+    queue->cond.notify_all();
+}
+
+/**
+ * @brief Waits for a demuxed packet and moves it out of the queue, called by the decode thread.
+ *          The packet is moved rather than peeked so a seek can flush the queue while it is decoded
+ * 
+ * @param queue pointer to packet queue
+ * @param pkt receives the oldest packet
+ * @param serial receives the seek generation of the packet
+ * @param serial_target receives the position the generation was seeked to, AV_NOPTS_VALUE without seek
+ * @return true if a packet was taken, false at end of stream or if playback was aborted
+ */
+static bool packet_queue_get(TPacketQueue* queue, AVPacket* pkt, int* serial, int64_t* serial_target)
+{
+    std::unique_lock<std::mutex> lock(queue->lock);
+    queue->cond.wait(lock, [queue] { return queue->size > 0 || queue->finished || queue->abort; });
+
+    if (queue->size == 0 || queue->abort)
+    {
+        return false;
+    }
+
+    av_packet_move_ref(pkt, queue->packets[queue->rindex]);
+    *serial = queue->serial;
+    *serial_target = queue->serial_target;
+    queue->rindex = (queue->rindex + 1) % queue->packets.size();
+    queue->size--;
+    queue->cond.notify_all();
+    return true;
+}
+
+/**
+ * @brief Drops all queued packets and starts a new seek generation, called by the demux thread after seeking
+ * 
+ * @param queue pointer to packet queue
+ * @param target position seeked to in stream time base
+ */
+static void packet_queue_flush(TPacketQueue* queue, int64_t target)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    for (; queue->size > 0; queue->size--)
+    {
+        av_packet_unref(queue->packets[queue->rindex]);
+        queue->rindex = (queue->rindex + 1) % queue->packets.size();
+    }
+    queue->serial++;
+    queue->serial_target = target;
+    queue->finished = false;
+    queue->seek_pending = queue->seek_req;
+    queue->cond.notify_all();
+}
+
+/**
+ * @brief Asks the demux thread to seek, replaces a request it has not picked up yet
+ * 
+ * @param queue pointer to packet queue
+ * @param target position in stream time base
+ */
+static void packet_queue_request_seek(TPacketQueue* queue, int64_t target)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    queue->seek_req = true;
+    queue->seek_pending = true;
+    queue->seek_target = target;
+    queue->cond.notify_all();
+}
+
+/**
+ * @brief Returns the current seek generation, frames of older generations are stale
+ * 
+ * @param queue pointer to packet queue
+ * @return int serial
+ */
+static int packet_queue_serial(TPacketQueue* queue)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return queue->serial;
+}
+
+/**
+ * @brief Checks whether playback still is in a seek generation, i.e. no seek has been requested
+ *          or carried out since
+ * 
+ * @param queue pointer to packet queue
+ * @param serial seek generation to check
+ * @return true if serial is current and no seek is pending
+ */
+static bool packet_queue_settled(TPacketQueue* queue, int serial)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return !queue->seek_pending && queue->serial == serial;
+}
+
+/**
+ * @brief Waits until a seek starts a new generation, called by the decode thread once it has drained
+ * 
+ * @param queue pointer to packet queue
+ * @param serial seek generation the decoder drained in
+ * @return true on a new generation, false if playback was aborted
+ */
+static bool packet_queue_wait_serial(TPacketQueue* queue, int serial)
+{
+    std::unique_lock<std::mutex> lock(queue->lock);
+    queue->cond.wait(lock, [queue, serial] { return queue->serial != serial || queue->abort; });
+
+    return !queue->abort;
+}
+
+/**
+ * @brief Marks the producer or consumer side as stopped and wakes up the other one
+ * 
+ * @param queue pointer to packet queue
+ * @param abort true when playback quits, false when the demuxer reached the end of the file.
+ *          A later seek resumes demuxing
+ */
+static void packet_queue_stop(TPacketQueue* queue, bool abort)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    if (abort)
+    {
+        queue->abort = true;
+    }
+    else
+    {
+        queue->finished = true;
+    }
+    queue->cond.notify_all();
+}
+
+/**
+ * @brief Checks whether seeking benefits from scanning the file for keyframes. Containers that
+ *          carry an index already have one, and remote inputs would be fetched a second time
+ * 
+ * @param ffmpegctx pointer to ffmpeg context after the input was opened
+ * @return true if the keyframe index thread should run
+ */
+static bool keyframe_index_wanted(const TFfmpegCtx* ffmpegctx)
+{
+    const char* protocol = avio_find_protocol_name(ffmpegctx->file);
+    const bool local = ffmpegctx->input.mode != INPUT_FILE || (protocol != nullptr && strcmp(protocol, "file") == 0);
+
+    return local && avformat_index_get_entries_count(ffmpegctx->stream) == 0;
+}
+
+/**
+ * @brief Index thread body, reads the file with its own demuxer and records every keyframe of the video stream
+ * 
+ * @param index pointer to keyframe index
+ * @param file path of the played file, a local file
+ * @param mode custom I/O the player reads the file with
+ * @param stream pointer to the played video stream, only read to match the stream in the second demuxer
+ */
+static void keyframe_index_thread(TKeyframeIndex* index, const char* file, EInputMode mode, const AVStream* stream)
+{
+    AVFormatContext* input_ctx = nullptr;
+    AVPacket* pkt = av_packet_alloc();
+    TMediaInput input;
+    const int stream_idx = stream->index;
+
+    /* Same I/O path as the player, so mapped or read ahead pages are shared with it */
+    if (pkt && mode != INPUT_FILE && media_input_open(&input, file, mode) == 0)
+    {
+        input_ctx = avformat_alloc_context();
+        if (input_ctx)
+        {
+            input_ctx->pb = input.avio;
+        }
+    }
+    if (!pkt || avformat_open_input(&input_ctx, file, nullptr, nullptr) < 0)
+    {
+        av_packet_free(&pkt);
+        media_input_close(&input);
+        return;
+    }
+
+    /* Streams some formats only create while probing have to exist before the indexes line up */
+    if (avformat_find_stream_info(input_ctx, nullptr) < 0 || stream_idx >= (int)input_ctx->nb_streams ||
+        input_ctx->streams[stream_idx]->codecpar->codec_type != stream->codecpar->codec_type ||
+        input_ctx->streams[stream_idx]->codecpar->codec_id != stream->codecpar->codec_id)
+    {
+        av_packet_free(&pkt);
+        avformat_close_input(&input_ctx);
+        media_input_close(&input);
+        return;
+    }
+
+    for (unsigned int i = 0; i < input_ctx->nb_streams; i++)
+    {
+        if ((int)i != stream_idx)
+        {
+            input_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+
+    while (!index->stop && av_read_frame(input_ctx, pkt) >= 0)
+    {
+        const int64_t pts = (pkt->pts != AV_NOPTS_VALUE) ? pkt->pts : pkt->dts;
+        if (pkt->stream_index != stream_idx)
+        {
+            /* Stream that appeared mid file */
+            input_ctx->streams[pkt->stream_index]->discard = AVDISCARD_ALL;
+        }
+        else if ((pkt->flags & AV_PKT_FLAG_KEY) && pts != AV_NOPTS_VALUE)
+        {
+            std::lock_guard<std::mutex> lock(index->lock);
+            /* Keyframes arrive in pts order apart from the odd reordered one */
+            const size_t at = std::upper_bound(index->pts.begin(), index->pts.end(), pts) - index->pts.begin();
+            index->pts.insert(index->pts.begin() + at, pts);
+            index->pos.insert(index->pos.begin() + at, pkt->pos);
+        }
+        av_packet_unref(pkt);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(index->lock);
+        index->complete = !index->stop;
+    }
+
+    av_packet_free(&pkt);
+    avformat_close_input(&input_ctx);
+    media_input_close(&input);
+}
+
+/**
+ * @brief Looks up the last keyframe at or before a position
+ * 
+ * @param index pointer to keyframe index
+ * @param target position in stream time base
+ * @param key_pts receives the keyframe pts
+ * @param key_pos receives the keyframe byte position, -1 if unknown
+ * @return true if the index covers the position
+ */
+static bool keyframe_index_find(TKeyframeIndex* index, int64_t target, int64_t* key_pts, int64_t* key_pos)
+{
+    std::lock_guard<std::mutex> lock(index->lock);
+
+    /* Past the scanned part there may be a closer keyframe we haven't seen yet */
+    if (index->pts.empty() || target < index->pts.front() || (target > index->pts.back() && !index->complete))
+    {
+        return false;
+    }
+
+    const size_t at = std::upper_bound(index->pts.begin(), index->pts.end(), target) - index->pts.begin() - 1;
+    *key_pts = index->pts[at];
+    *key_pos = index->pos[at];
+    return true;
+}
+
+/**
+ * @brief Moves the demuxer to the keyframe at or before a position
+ * 
+ * @param ffmpegctx pointer to ffmpeg context
+ * @param index optional keyframe index
+ * @param target position in stream time base
+ */
+static void seek_stream(TFfmpegCtx* ffmpegctx, TKeyframeIndex* index, int64_t target)
+{
+    int64_t key_pts = target;
+    int64_t key_pos = -1;
+    int ret;
+
+    if (index)
+    {
+        keyframe_index_find(index, target, &key_pts, &key_pos);
+    }
+
+    ret = av_seek_frame(ffmpegctx->input_ctx, ffmpegctx->stream_idx, key_pts, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0 && key_pos >= 0)
+    {
+        /* Some formats can't seek by timestamp, the indexed byte position works for those */
+        ret = av_seek_frame(ffmpegctx->input_ctx, ffmpegctx->stream_idx, key_pos, AVSEEK_FLAG_BYTE);
+    }
+    if (ret < 0)
+    {
+        std::cerr << "Seek error: " << ret << std::endl;
+    }
+}
+
+/**
+ * @brief Demux thread body, reads video packets into the packet queue and serves seek requests until abort
+ * 
+ * @param ffmpegctx pointer to ffmpeg context, only the format context is used by this thread
+ * @param queue pointer to packet queue
+ * @param index optional keyframe index to seek with
+ */
+static void demux_thread(TFfmpegCtx* ffmpegctx, TPacketQueue* queue, TKeyframeIndex* index)
+{
+    while (true)
+    {
+        bool seek = false;
+        int64_t seek_target = 0;
+        AVPacket* slot = packet_queue_peek_writable(queue, &seek, &seek_target);
+        if (seek)
+        {
+            /* Whatever was queued belongs to the old position */
+            seek_stream(ffmpegctx, index, seek_target);
+            packet_queue_flush(queue, seek_target);
+            continue;
+        }
+        else if (!slot)
+        {
+            break;
+        }
+
+        const int ret = av_read_frame(ffmpegctx->input_ctx, slot);
+        if (ret < 0)
+        {
+            if (ret != AVERROR_EOF)
+            {
+                std::cerr << "read frame error: " << ret << std::endl;
+            }
+
+            /* Let the decoder drain, then wait for a seek or abort */
+            packet_queue_stop(queue, false);
+            continue;
+        }
+
+        /* Discarded streams rarely slip through, reuse the slot for the next read */
+        if (slot->stream_index != ffmpegctx->stream_idx)
+        {
+            av_packet_unref(slot);
+            continue;
+        }
+
+        packet_queue_push(queue);
+    }
+}
+
+/**
+ * @brief Attempts to decode next frame using Ffmpeg library
+ * 
+ * @param ffmpegctx pointer to ffmpeg context
+ * @param packets pointer to queue of demuxed video packets
+ * @return int 0 or error code
+ */
+static int get_frame(TFfmpegCtx* ffmpegctx, TPacketQueue* packets)
+{
+    int ret = 0;
+
+    /* Hand out frames the decoder already holds before feeding it more data */
+    ret = avcodec_receive_frame(ffmpegctx->codec_ctx, ffmpegctx->decframe);
+    if (ret == 0)
+    {
+        ffmpegctx->got_image = 1;
+        return 0;
+    }
+    
+    ffmpegctx->got_image = 0;
+    if (ret == AVERROR_EOF)
+    {
+        /* Decoder is fully drained */
+        return 1;
+    }
+    else if (ret != AVERROR(EAGAIN)) 
+    {
+        fprintf(stderr, "Decoder error\n");
+        return -1;
+    }
+
+    /* Take next packet, the queue only holds packets of our stream */
+    if (!ffmpegctx->end_of_stream) 
+    {
+        int serial = 0;
+        int64_t serial_target = AV_NOPTS_VALUE;
+        ffmpegctx->end_of_stream = !packet_queue_get(packets, ffmpegctx->pkt, &serial, &serial_target);
+
+        /* First packet after a seek, drop the frames still held for the old position */
+        if (!ffmpegctx->end_of_stream && serial != ffmpegctx->serial)
+        {
+            avcodec_flush_buffers(ffmpegctx->codec_ctx);
+            ffmpegctx->serial = serial;
+            ffmpegctx->skip_pts = serial_target;
+        }
+    }
+    else if (ffmpegctx->flush_sent)
+    {
+        return 1;
+    }
+    
+    /* Decode packet, a single null packet at end of stream drains the decoder */
+    ret = avcodec_send_packet(ffmpegctx->codec_ctx, ffmpegctx->end_of_stream ? nullptr : ffmpegctx->pkt);
+    av_packet_unref(ffmpegctx->pkt);
+    if (ret < 0) 
+    {
+        fprintf(stderr, "Error sending a packet for decoding\n");
+        return -1;
+    }
+    ffmpegctx->flush_sent = ffmpegctx->end_of_stream;
+
+    /* See if we have a frame */
+    ret = avcodec_receive_frame(ffmpegctx->codec_ctx, ffmpegctx->decframe);
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+    {
+        return 1;
+    }
+    else if (ret < 0) 
+    {
+        fprintf(stderr, "Decoder error\n");
+        return -1;
+    }
+
+    ffmpegctx->got_image = 1;
+    return 0;
+}
+
+/**
+ * @brief Allocates frame slots of the decoded frame ring
+ * 
+ * @param queue pointer to frame queue
+ * @param depth number of frames that can be buffered
+ * @return int 0 or error code
+ */
+static int frame_queue_init(TFrameQueue* queue, int depth)
+{
+    queue->frames.resize(depth, nullptr);
+    queue->serials.resize(depth, 0);
+    for (auto& frame : queue->frames)
+    {
+        frame = av_frame_alloc();
+        if (!frame)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Releases all frame slots of the decoded frame ring
+ * 
+ * @param queue pointer to frame queue
+ */
+static void frame_queue_destroy(TFrameQueue* queue)
+{
+    for (auto& frame : queue->frames)
+    {
+        av_frame_free(&frame);
+    }
+    queue->frames.clear();
+}
+
+/**
+ * @brief Waits for a free slot, called by the decode thread
+ * 
+ * @param queue pointer to frame queue
+ * @return AVFrame* slot to move the decoded frame into or nullptr if playback was aborted
+ */
+static AVFrame* frame_queue_peek_writable(TFrameQueue* queue)
+{
+    std::unique_lock<std::mutex> lock(queue->lock);
+    queue->cond.wait(lock, [queue] { return queue->size < queue->frames.size() || queue->abort; });
+
+    return queue->abort ? nullptr : queue->frames[queue->windex];
+}
+
+/**
+ * @brief Publishes the slot returned by frame_queue_peek_writable() to the render loop
+ * 
+ * @param queue pointer to frame queue
+ * @param serial seek generation the frame was decoded in
+ */
+static void frame_queue_push(TFrameQueue* queue, int serial)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    queue->serials[queue->windex] = serial;
+    queue->windex = (queue->windex + 1) % queue->frames.size();
+    queue->size++;
+    queue->cond.notify_all();
+}
+
+/**
+ * @brief Waits for a decoded frame, called by the render loop
+ * 
+ * @param queue pointer to frame queue
+ * @param timeout maximum time to wait so the event loop keeps running during decoder stalls
+ * @param serial receives the seek generation of the frame
+ * @return AVFrame* oldest decoded frame or nullptr if none is ready yet
+ */
+static AVFrame* frame_queue_peek_readable(TFrameQueue* queue, std::chrono::milliseconds timeout, int* serial)
+{
+    std::unique_lock<std::mutex> lock(queue->lock);
+    queue->cond.wait_for(lock, timeout, [queue] { return queue->size > 0 || queue->finished || queue->abort; });
+
+    *serial = queue->serials[queue->rindex];
+    return (queue->size > 0 && !queue->abort) ? queue->frames[queue->rindex] : nullptr;
+}
+
+/**
+ * @brief Looks at the frame after the one returned by frame_queue_peek_readable(), called by the render loop
+ * 
+ * @param queue pointer to frame queue
+ * @param serial receives the seek generation of the frame
+ * @return AVFrame* second oldest decoded frame or nullptr if only one is queued
+ */
+static AVFrame* frame_queue_peek_next(TFrameQueue* queue, int* serial)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    if (queue->size < 2)
+    {
+        return nullptr;
+    }
+
+    const size_t index = (queue->rindex + 1) % queue->frames.size();
+    *serial = queue->serials[index];
+    return queue->frames[index];
+}
+
+/**
+ * @brief Releases the frame returned by frame_queue_peek_readable() and hands its slot back to the decoder
+ * 
+ * @param queue pointer to frame queue
+ */
+static void frame_queue_next(TFrameQueue* queue)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    av_frame_unref(queue->frames[queue->rindex]);
+    queue->rindex = (queue->rindex + 1) % queue->frames.size();
+    queue->size--;
+    queue->cond.notify_all();
+}
+
+/**
+ * @brief Checks whether the decoder is done and every queued frame has been consumed
+ * 
+ * @param queue pointer to frame queue
+ * @param finished_serial receives the seek generation the decoder drained in, -1 if it exited
+ * @return true when there is nothing left to render
+ */
+static bool frame_queue_drained(TFrameQueue* queue, int* finished_serial)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    *finished_serial = queue->finished_serial;
+    return queue->finished && queue->size == 0;
+}
+
+/**
+ * @brief Marks the producer or consumer side as stopped and wakes up the other one
+ * 
+ * @param queue pointer to frame queue
+ * @param abort true when the render loop quits, false when the decoder exited
+ */
+static void frame_queue_stop(TFrameQueue* queue, bool abort)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    if (abort)
+    {
+        queue->abort = true;
+    }
+    else
+    {
+        queue->finished = true;
+        queue->finished_serial = -1;
+    }
+    queue->cond.notify_all();
+}
+
+/**
+ * @brief Marks the decoder as drained at end of stream. Unlike frame_queue_stop() a later seek
+ *          resumes the queue with frame_queue_resume()
+ * 
+ * @param queue pointer to frame queue
+ * @param serial seek generation the decoder drained in
+ */
+static void frame_queue_finish(TFrameQueue* queue, int serial)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    queue->finished = true;
+    queue->finished_serial = serial;
+    queue->cond.notify_all();
+}
+
+/**
+ * @brief Reopens a queue finished by frame_queue_finish(), called by the decode thread after a seek
+ * 
+ * @param queue pointer to frame queue
+ */
+static void frame_queue_resume(TFrameQueue* queue)
+{
+    std::lock_guard<std::mutex> lock(queue->lock);
+    queue->finished = false;
+    queue->finished_serial = -1;
+}
+
+/**
+ * @brief Checks whether the last frame has been shown. A seek requested before the decoder
+ *          drained, or while the render loop was still showing its last frames, keeps playback going
+ * 
+ * @param frames pointer to frame queue
+ * @param packets pointer to packet queue
+ * @return true when the player is done
+ */
+static bool playback_finished(TFrameQueue* frames, TPacketQueue* packets)
+{
+    int finished_serial = -1;
+    if (!frame_queue_drained(frames, &finished_serial))
+    {
+        return false;
+    }
+
+    return finished_serial < 0 || packet_queue_settled(packets, finished_serial);
+}
+
+/**
+ * @brief Decode thread body, keeps the frame queue filled until end of stream, error or abort
+ * 
+ * @param ffmpegctx pointer to ffmpeg context, the decoder is owned by this thread while it runs
+ * @param packets pointer to packet queue fed by the demux thread
+ * @param queue pointer to frame queue
+ * @param stats optional, receives the time spent in get_frame() per decoded frame
+ */
+static void decode_thread(TFfmpegCtx* ffmpegctx, TPacketQueue* packets, TFrameQueue* queue, TBenchStats* stats)
+{
+    std::chrono::steady_clock::duration decode_time(0);
+
+    while (true)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const int ret = get_frame(ffmpegctx, packets);
+        decode_time += std::chrono::steady_clock::now() - start;
+        if (ret > 0)
+        {
+            if (ffmpegctx->flush_sent)
+            {
+                /* Decoder drained, the render loop shows the last frames unless a seek comes in meanwhile.
+                   The drained decoder only takes packets again after a flush */
+                frame_queue_finish(queue, ffmpegctx->serial);
+                if (!packet_queue_wait_serial(packets, ffmpegctx->serial))
+                {
+                    break;
+                }
+                avcodec_flush_buffers(ffmpegctx->codec_ctx);
+                ffmpegctx->end_of_stream = false;
+                ffmpegctx->flush_sent = false;
+                frame_queue_resume(queue);
+                continue;
+            }
+
+            /* Not enough data to decode whole frame, try again */
+            continue;
+        }
+        else if (ret < 0)
+        {
+            /* Something went wrong */
+            break;
+        }
+
+        /* After a seek decoding starts at the keyframe before the target, frames up to the target are never shown */
+        if (ffmpegctx->skip_pts != AV_NOPTS_VALUE)
+        {
+            if (ffmpegctx->decframe->best_effort_timestamp != AV_NOPTS_VALUE && ffmpegctx->decframe->best_effort_timestamp < ffmpegctx->skip_pts)
+            {
+                av_frame_unref(ffmpegctx->decframe);
+                continue;
+            }
+            ffmpegctx->skip_pts = AV_NOPTS_VALUE;
+        }
+
+        if (stats)
+        {
+            stats->decode_ms.push_back(std::chrono::duration<double, std::milli>(decode_time).count());
+        }
+        decode_time = std::chrono::steady_clock::duration(0);
+
+        AVFrame* slot = frame_queue_peek_writable(queue);
+        if (!slot)
+        {
+            break;
+        }
+
+        av_frame_move_ref(slot, ffmpegctx->decframe);
+        frame_queue_push(queue, ffmpegctx->serial);
+    }
+
+    frame_queue_stop(queue, false);
+}
+
+/**
+ * @brief Rounds a buffer size up to the arena alignment
+ */
+static size_t arena_align(size_t size)
+{
+    return (size + arena_alignment - 1) & ~(arena_alignment - 1);
+}
+
+/**
+ * @brief Computes the character grid from the source dimensions and allocates
+ *          every conversion buffer at once
+ * 
+ * @param convctx pointer to conversion context
+ * @param width source width in pixels
+ * @param height source height in pixels
+ * @param lowres reduced resolution factor the decoder runs at
+ * @param options pointer to player options (ramp, tile size, conversion mode)
+ * @return int 0 or error code
+ */
+static int init_convert(TConvertCtx* convctx, int width, int height, int lowres, const TPlayerOptions* options)
+{
+    convctx->cols = width / options->tile_width;
+    convctx->rows = height / options->tile_height;
+    convctx->mode = options->convert_mode;
+
+    /* Pick tile kernel for this CPU, reduced resolution decoding shrinks the tile by the same factor */
+    convctx->tile_w = options->tile_width >> lowres;
+    convctx->tile_h = options->tile_height >> lowres;
+    convctx->tile_kernel = select_tile_row_kernel(convctx->tile_w, convctx->tile_h, &convctx->kernel_name);
+
+    const int tile_pixels = convctx->tile_w * convctx->tile_h;
+    const size_t cells = (size_t)convctx->cols * convctx->rows;
+    const size_t lut_size = 255 * tile_pixels + 1;
+    /* Shape matching scales to one sample per quadrant */
+    const int gray_scale = (options->glyph_mode == GLYPHS_SHAPE) ? 2 : 1;
+    convctx->gray_linesize = (int)arena_align(convctx->cols * gray_scale);
+
+    /* Shape matching sums two quadrants per tile for the upper and the lower half */
+    const size_t tile_sums_size = arena_align(4 * convctx->cols * sizeof(uint16_t));
+    const size_t lut_tiles_size = arena_align(lut_size);
+    const size_t lut_gray_size = arena_align(256);
+    const size_t gray_size = arena_align((size_t)convctx->gray_linesize * convctx->rows * gray_scale);
+    const size_t ascii_size = arena_align(cells + 1);
+    const size_t edge_size = (options->edge_threshold > 0) ? arena_align(4 * (size_t)convctx->cols * convctx->tile_w * sizeof(int32_t)) : 0;
+    const int quadrant_pixels = (convctx->tile_w / 2) * (convctx->tile_h / 2);
+    const size_t level_size = (options->glyph_mode == GLYPHS_SHAPE) ? arena_align(255 * quadrant_pixels + 1) : 0;
+    const size_t level_gray_size = (options->glyph_mode == GLYPHS_SHAPE) ? arena_align(256) : 0;
+    const size_t shape_size = (options->glyph_mode == GLYPHS_SHAPE) ? arena_align(SHAPE_LUT_SIZE) : 0;
+    convctx->colors_linesize = (int)arena_align(convctx->cols * 4);
+    const size_t colors_size = options->color ? (size_t)convctx->colors_linesize * convctx->rows : 0;
+
+    convctx->arena = (uint8_t*)av_malloc(tile_sums_size + 2 * lut_tiles_size + lut_gray_size + gray_size + ascii_size + edge_size +
+                                         2 * level_size + level_gray_size + shape_size + colors_size);
+    if (convctx->arena == nullptr)
+    {
+        return 1;
+    }
+
+    uint8_t* next = convctx->arena;
+    convctx->tile_sums = (uint16_t*)next;
+    next += tile_sums_size;
+    convctx->lut_limited = (char*)next;
+    next += lut_tiles_size;
+    convctx->lut_full = (char*)next;
+    next += lut_tiles_size;
+    convctx->lut_gray = (char*)next;
+    next += lut_gray_size;
+    convctx->gray = next;
+    next += gray_size;
+    convctx->ascii = (char*)next;
+    next += ascii_size;
+    convctx->edge_columns = (edge_size > 0) ? (int32_t*)next : nullptr;
+    convctx->edge_threshold = options->edge_threshold;
+    next += edge_size;
+
+    convctx->glyph_mode = options->glyph_mode;
+    if (convctx->glyph_mode == GLYPHS_SHAPE)
+    {
+        convctx->quadrant_kernel = select_tile_row_kernel(convctx->tile_w / 2, convctx->tile_h / 2, nullptr);
+        convctx->level_limited = next;
+        next += level_size;
+        convctx->level_full = next;
+        next += level_size;
+        convctx->level_gray = next;
+        next += level_gray_size;
+        convctx->shape_lut = (char*)next;
+        next += shape_size;
+
+        /* Glyph table is filled in once the font is loaded */
+        build_quadrant_lut(convctx->level_limited, quadrant_pixels, true);
+        build_quadrant_lut(convctx->level_full, quadrant_pixels, false);
+        build_quadrant_lut(convctx->level_gray, 1, false);
+        memset(convctx->shape_lut, ' ', SHAPE_LUT_SIZE);
+    }
+
+    convctx->color = options->color;
+    if (convctx->color)
+    {
+        convctx->colors = next;
+        memset(convctx->colors, 0xFF, colors_size);
+    }
+
+    /* Precompute tile sum to character mapping for both color ranges, scaler output is always full range */
+    build_glyph_lut(convctx->lut_limited, tile_pixels, true, options->ramp, options->ramp_len);
+    build_glyph_lut(convctx->lut_full, tile_pixels, false, options->ramp, options->ramp_len);
+    build_glyph_lut(convctx->lut_gray, 1, false, options->ramp, options->ramp_len);
+
+    memset(convctx->ascii, ' ', cells);
+    convctx->ascii[cells] = '\0';
+
+    return 0;
+}
+
+/**
+ * @brief Releases the conversion arena and scaler
+ * 
+ * @param convctx pointer to conversion context
+ */
+static void free_convert(TConvertCtx* convctx)
+{
+    sws_freeContext(convctx->gray_scaler.sws);
+    convctx->gray_scaler.sws = nullptr;
+    sws_freeContext(convctx->color_scaler.sws);
+    convctx->color_scaler.sws = nullptr;
+    av_freep(&convctx->arena);
+}
+
+/**
+ * @brief Checks if the first plane of a pixel format holds plain 8-bit luma the tile kernels can sum
+ * 
+ * @param format pixel format of the decoded frame
+ * @return true for 8-bit planar or semi-planar YUV and gray formats
+ */
+static bool has_8bit_luma_plane(int format)
+{
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get((AVPixelFormat)format);
+    if (desc == nullptr || desc->nb_components == 0)
+    {
+        return false;
+    }
+
+    return !(desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | 
+                            AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_FLOAT)) &&
+           desc->comp[0].plane == 0 && desc->comp[0].step == 1 && desc->comp[0].depth == 8 && desc->comp[0].shift == 0;
+}
+
+/**
+ * @brief Converts a frame by summing tiles of its luma plane with the SIMD tile kernels
+ * 
+ * @param frame pointer to decoded frame with an 8-bit luma plane
+ * @param range color range of the frame
+ * @param convctx pointer to conversion context
+ * @param ascii_buffer buffer to store the ASCII-coverted frame, one line of characters per tile row
+ */
+static void convert_frame_tiles(AVFrame* frame, enum AVColorRange range, TConvertCtx* convctx, char* ascii_buffer)
+{
+    const int cols = std::min(frame->width / convctx->tile_w, convctx->cols);
+    const int rows = std::min(frame->height / convctx->tile_h, convctx->rows);
+    const char* lut = (range != AVCOL_RANGE_JPEG) ? convctx->lut_limited : convctx->lut_full;
+    uint16_t* tile_sums = convctx->tile_sums;
+
+    /* A frame smaller than the stream dimensions leaves the rest of the grid blank */
+    if (cols < convctx->cols || rows < convctx->rows)
+    {
+        memset(ascii_buffer, ' ', convctx->cols * convctx->rows);
+    }
+
+    if (convctx->glyph_mode == GLYPHS_SHAPE)
+    {
+        const uint8_t* level_lut = (range != AVCOL_RANGE_JPEG) ? convctx->level_limited : convctx->level_full;
+        const int half_h = convctx->tile_h / 2;
+        uint16_t* top = tile_sums;
+        uint16_t* bottom = tile_sums + 2 * cols;
+
+        /* Quadrant sums are sums of half size tiles, two per tile in each half row */
+        for (int row = 0; row < rows; row++)
+        {
+            const uint8_t* src = &frame->data[0][row * convctx->tile_h * frame->linesize[0]];
+            convctx->quadrant_kernel(src, frame->linesize[0], 2 * cols, top);
+            convctx->quadrant_kernel(src + half_h * frame->linesize[0], frame->linesize[0], 2 * cols, bottom);
+            quadrants_to_ascii(top, bottom, cols, level_lut, convctx->shape_lut, &ascii_buffer[row * convctx->cols]);
+        }
+        return;
+    }
+
+    if (convctx->edge_threshold > 0)
+    {
+        /* Luma and gradients come out of the same pass over each tile row */
+        for (int row = 0; row < rows; row++)
+        {
+            tile_row_edges_to_ascii(frame->data[0], frame->linesize[0], frame->height, row * convctx->tile_h, convctx->tile_w, convctx->tile_h,
+                                    cols, convctx->edge_threshold, lut, convctx->edge_columns, &ascii_buffer[row * convctx->cols]);
+        }
+        return;
+    }
+
+    for (int row = 0; row < rows; row++) 
+    {
+        /* Sum a whole row of tiles at once, we extract luma data from Y channel of YUV420p */
+        convctx->tile_kernel(&frame->data[0][row * convctx->tile_h * frame->linesize[0]], frame->linesize[0], cols, tile_sums);
+
+        /* Map tile sums to characters */
+        tile_sums_to_ascii(tile_sums, cols, lut, &ascii_buffer[row * convctx->cols]);
+    }
+}
+
+/**
+ * @brief Area-averages a frame down to the character grid, the scaler is only rebuilt when the input changes
+ * 
+ * @param scaler pointer to the cached scaler for this output
+ * @param frame pointer to decoded frame
+ * @param range color range of the frame
+ * @param cols number of character columns
+ * @param rows number of character rows
+ * @param format output pixel format
+ * @param dst output plane
+ * @param dst_linesize distance between two output rows in bytes
+ * @return bool false if no scaler exists for the input format
+ */
+static bool scale_to_grid(TCachedScaler* scaler, AVFrame* frame, enum AVColorRange range, int cols, int rows,
+                          AVPixelFormat format, uint8_t* dst, int dst_linesize)
+{
+    if (scaler->sws == nullptr || frame->width != scaler->width || frame->height != scaler->height ||
+        frame->format != scaler->format || range != scaler->range)
+    {
+        scaler->sws = sws_getCachedContext(scaler->sws, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                           cols, rows, format, SWS_AREA, nullptr, nullptr, nullptr);
+        if (scaler->sws == nullptr)
+        {
+            return false;
+        }
+
+        /* Expand limited range input so a single full range table serves every source */
+        const int* coefficients = sws_getCoefficients(SWS_CS_DEFAULT);
+        sws_setColorspaceDetails(scaler->sws, coefficients, range == AVCOL_RANGE_JPEG, coefficients, 1, 0, 1 << 16, 1 << 16);
+
+        scaler->width = frame->width;
+        scaler->height = frame->height;
+        scaler->format = frame->format;
+        scaler->range = range;
+    }
+
+    uint8_t* dst_data[4] = {dst, nullptr, nullptr, nullptr};
+    int dst_linesizes[4] = {dst_linesize, 0, 0, 0};
+    sws_scale(scaler->sws, frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesizes);
+    return true;
+}
+
+/**
+ * @brief Converts a frame of any pixel format by letting swscale area-average it
+ *          straight to a full range gray plane with one sample per character,
+ *          or one sample per quadrant for shape matching
+ * 
+ * @param frame pointer to decoded frame
+ * @param range color range of the frame
+ * @param convctx pointer to conversion context
+ * @param ascii_buffer buffer to store the ASCII-coverted frame, one line of characters per tile row
+ */
+static void convert_frame_sws(AVFrame* frame, enum AVColorRange range, TConvertCtx* convctx, char* ascii_buffer)
+{
+    const int scale = (convctx->glyph_mode == GLYPHS_SHAPE) ? 2 : 1;
+
+    if (!scale_to_grid(&convctx->gray_scaler, frame, range, scale * convctx->cols, scale * convctx->rows, AV_PIX_FMT_GRAY8,
+                       convctx->gray, convctx->gray_linesize))
+    {
+        memset(ascii_buffer, ' ', convctx->cols * convctx->rows);
+        return;
+    }
+
+    if (convctx->glyph_mode == GLYPHS_SHAPE)
+    {
+        uint16_t* top = convctx->tile_sums;
+        uint16_t* bottom = convctx->tile_sums + 2 * convctx->cols;
+
+        /* Every gray sample is a quadrant already, widen two rows of them per character row */
+        for (int row = 0; row < convctx->rows; row++)
         {
-            std::cerr << "read frame error: " << ret;
-            return -1;
+            const uint8_t* upper = &convctx->gray[2 * row * convctx->gray_linesize];
+            const uint8_t* lower = upper + convctx->gray_linesize;
+            for (int x = 0; x < 2 * convctx->cols; x++)
+            {
+                top[x] = upper[x];
+                bottom[x] = lower[x];
+            }
+            quadrants_to_ascii(top, bottom, convctx->cols, convctx->level_gray, convctx->shape_lut, &ascii_buffer[row * convctx->cols]);
         }
+        return;
+    }
+
+    for (int row = 0; row < convctx->rows; row++)
+    {
+        luma_to_ascii(&convctx->gray[row * convctx->gray_linesize], convctx->cols, convctx->lut_gray, &ascii_buffer[row * convctx->cols]);
+    }
+}
+
+/**
+ * @brief Takes a decoded video frame and converts it into an ASCII representation,
+ *          each character stands for the average luma of one tile
+ * 
+ * @param frame pointer to decoded frame
+ * @param color_range color range signalled by the stream
+ * @param convctx pointer to conversion context
+ * @param ascii_buffer buffer to store the ASCII-coverted frame, one line of characters per tile row
+ */
+static void convert_frame(AVFrame* frame, enum AVColorRange color_range, TConvertCtx* convctx, char* ascii_buffer)
+{
+    const enum AVColorRange range = (frame->color_range != AVCOL_RANGE_UNSPECIFIED) ? frame->color_range : color_range;
+
+    if (convctx->mode == CONVERT_TILES || (convctx->mode == CONVERT_AUTO && has_8bit_luma_plane(frame->format)))
+    {
+        convert_frame_tiles(frame, range, convctx, ascii_buffer);
+    }
+    else
+    {
+        convert_frame_sws(frame, range, convctx, ascii_buffer);
+    }
 
-        if (ret == 0 && ffmpegctx->pkt->stream_index != ffmpegctx->stream_idx)
+    if (convctx->color)
+    {
+        if (scale_to_grid(&convctx->color_scaler, frame, range, convctx->cols, convctx->rows, AV_PIX_FMT_RGBA, convctx->colors, convctx->colors_linesize))
         {
-            av_packet_unref(ffmpegctx->pkt);
-            return 1;
+            for (int row = 0; row < convctx->rows; row++)
+            {
+                normalize_cell_colors(&convctx->colors[row * convctx->colors_linesize], convctx->cols);
+            }
+        }
+        else
+        {
+            memset(convctx->colors, 0xFF, (size_t)convctx->colors_linesize * convctx->rows);
         }
-        
-        ffmpegctx->end_of_stream = (ret == AVERROR_EOF);
     }
-    
-    /* Make a final dummy packet to end loop */
-    if (ffmpegctx->end_of_stream) 
+}
+
+/**
+ * @brief Renders an ASCII frame using SDL/SDL_ttf/SDL Font cache and presents it
+ * 
+ * @param sdlctx pointer to SDL context
+ * @param ascii_buffer characters of the frame, row by row
+ * @param cols number of character columns
+ * @param rows number of character rows
+ * @param colors optional cell colors, 4 bytes (R, G, B, A) per cell, NULL to use the font color
+ * @param colors_linesize distance between two rows of colors in bytes
+ */
+static void render_frame(TSDLContext* sdlctx, const char* ascii_buffer, int cols, int rows, const uint8_t* colors, int colors_linesize)
+{
+    TDeltaCtx* delta = &sdlctx->delta;
+
+    /* Frames identical to the previous one only need presenting again */
+    if (delta->enabled)
     {
-        ffmpegctx->pkt = av_packet_alloc();
-        ffmpegctx->pkt->data = nullptr;
-        ffmpegctx->pkt->size = 0;
+        find_dirty_rows(delta, ascii_buffer, cols, rows, colors, colors_linesize);
     }
-    
-    /* Decode packet and see if we have a frame */
-    ret = avcodec_send_packet(ffmpegctx->codec_ctx, ffmpegctx->pkt);
-    if (ret < 0) 
+
+    /* Reset viewport */
+    SDL_SetRenderDrawColor(sdlctx->renderer, 0x00, 0x00, 0x00, 0x00);
+    SDL_RenderClear(sdlctx->renderer);
+
+    if (sdlctx->render_mode == RENDER_COMPOSITE)
     {
-        fprintf(stderr, "Error sending a packet for decoding\n");
-        return -1;
+        /* The composited pixels persist, so only changed rows are rebuilt and uploaded */
+        composite_frame(&sdlctx->composite, ascii_buffer, cols, rows, colors, colors_linesize, delta->enabled ? delta->dirty.data() : nullptr);
+        SDL_Rect dst = {0, 0, cols * sdlctx->composite.cell_w, rows * sdlctx->composite.cell_h};
+        SDL_RenderCopy(sdlctx->renderer, sdlctx->composite.texture, nullptr, &dst);
     }
+    else if (delta->enabled)
+    {
+        if (!delta->valid)
+        {
+            /* Canvas content is undefined until the first full frame */
+            SDL_SetRenderTarget(sdlctx->renderer, delta->canvas);
+            SDL_RenderClear(sdlctx->renderer);
+            SDL_SetRenderTarget(sdlctx->renderer, nullptr);
+        }
+        draw_dirty_rows(sdlctx, ascii_buffer, cols, rows, colors, colors_linesize);
 
-    ffmpegctx->got_image = 1;
-    ret = avcodec_receive_frame(ffmpegctx->codec_ctx, ffmpegctx->decframe);
-    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+        int canvas_w, canvas_h;
+        SDL_QueryTexture(delta->canvas, nullptr, nullptr, &canvas_w, &canvas_h);
+        SDL_Rect dst = {0, 0, canvas_w, canvas_h};
+        SDL_RenderCopy(sdlctx->renderer, delta->canvas, nullptr, &dst);
+    }
+    else
     {
-        ffmpegctx->got_image = 0;
-        av_packet_unref(ffmpegctx->pkt);
-        return 1;
+        /* Draw the whole frame in one batch, line height is set by the tile height.
+           Cell colors become vertex colors, so color costs no extra draw calls */
+        FC_DrawGridColors(sdlctx->fc_font, sdlctx->renderer, 0, 0, sdlctx->line_height, (const Uint8*)ascii_buffer, cols, rows, cols,
+                          (const SDL_Color*)colors, colors_linesize / (int)sizeof(SDL_Color));
     }
-    else if (ret < 0) 
+
+    delta->valid = delta->enabled;
+
+    /* Update viewport */
+    SDL_RenderPresent(sdlctx->renderer);
+}
+
+/**
+ * @brief Prepares the presentation clock for a stream
+ * 
+ * @param clock pointer to presentation clock
+ * @param stream pointer to the played video stream
+ */
+static void present_clock_init(TPresentClock* clock, AVStream* stream)
+{
+    auto plausible = [](AVRational rate) { return rate.num > 0 && rate.den > 0 && rate.num <= (int64_t)max_frame_rate * rate.den; };
+
+    /* Only used for timestamp-less frames and polling, the schedule itself comes from timestamps */
+    AVRational rate = stream->avg_frame_rate;
+    if (!plausible(rate))
     {
-        ffmpegctx->got_image = 0;
-        fprintf(stderr, "Decoder error\n");
-        return -1;
+        rate = plausible(stream->r_frame_rate) ? stream->r_frame_rate : fallback_frame_rate;
     }
 
-    av_packet_unref(ffmpegctx->pkt);
-    return 0;
+    clock->time_base = stream->time_base;
+    clock->frame_duration = std::chrono::microseconds(av_rescale_q(1, AVRational{rate.den, rate.num}, AVRational{1, us_per_sec}));
 }
 
 /**
- * @brief Takes a decoded video frame and converts it into an ASCII representation using SDL/SDL_ttf/SDL Font cache
- *          IMPORTANT: Tiling of the image is hardcoded. Each tile is averaged to get an
- *                      ASCII character to ouput
+ * @brief Re-anchors the presentation clock on the next frame, used after seeking
  * 
- * @param renderer pointer to SDL renderer
- * @param fc_font pointer to cached SDL Font 
+ * @param clock pointer to presentation clock
+ */
+static void present_clock_reset(TPresentClock* clock)
+{
+    clock->started = false;
+    clock->last_pts = AV_NOPTS_VALUE;
+}
+
+/**
+ * @brief Converts a timestamp to its presentation time on the running clock
+ * 
+ * @param clock pointer to started presentation clock
+ * @param pts timestamp in stream time base
+ * @return std::chrono::steady_clock::time_point presentation time
+ */
+static std::chrono::steady_clock::time_point present_clock_time(const TPresentClock* clock, int64_t pts)
+{
+    return clock->start_time + std::chrono::microseconds(av_rescale_q(pts - clock->start_pts, clock->time_base, AVRational{1, us_per_sec}));
+}
+
+/**
+ * @brief Re-anchors the running clock so the last scheduled frame is due now
+ * 
+ * @param clock pointer to started presentation clock
+ * @return std::chrono::steady_clock::time_point new presentation time of the last frame
+ */
+static std::chrono::steady_clock::time_point present_clock_resync(TPresentClock* clock)
+{
+    clock->start_pts = clock->last_pts;
+    clock->start_time = std::chrono::steady_clock::now();
+    return clock->start_time;
+}
+
+/**
+ * @brief Computes when a frame is due. The first frame anchors the clock, later frames are
+ *          placed by their timestamp difference to it, so rounding never accumulates.
+ *          Timestamp discontinuities re-anchor the clock on the frame that follows them
+ * 
+ * @param clock pointer to presentation clock
  * @param frame pointer to decoded frame
- * @param ascii_buffer buffer to store ASCII-coverted video lines
+ * @return std::chrono::steady_clock::time_point presentation time
  */
-static void handle_frame(SDL_Renderer *renderer, FC_Font* fc_font, AVFrame* frame, enum AVColorRange color_range, char* ascii_buffer)
+static std::chrono::steady_clock::time_point present_clock_due(TPresentClock* clock, AVFrame* frame)
 {
-    /* Reset viewport */
-    SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0x00);
-    SDL_RenderClear(renderer);
-    int character_index;
-
-    /* Average values of pixels within a tile of a frame and store them in an array */
-    for (int heightIdx = 0; heightIdx < frame->height; heightIdx += tile_size) 
-    {
-        for (int widthIdx = 0, cellId = 0; widthIdx < frame->width; widthIdx += tile_size, cellId++) 
-        {
-            /* For simplicity tiling is hardcoded */
-            /* We extract luma data from Y channel of YUV420p */
-            const uint8_t* line1 = &frame->data[0][heightIdx * frame->linesize[0] + widthIdx];
-            const uint8_t* line2 = line1 + frame->linesize[0];
-            const uint8_t* line3 = line2 + frame->linesize[0];
-            const uint8_t* line4 = line3 + frame->linesize[0];
-            const float tile_luma = (line1[0] + line1[1] + line1[2] + line1[3] +
-                                    line2[0] + line2[1] + line2[2] + line2[3] +
-                                    line3[0] + line3[1] + line3[2] + line3[3] +
-                                    line4[0] + line4[1] + line4[2] + line4[3]) / 
-                                    (tile_size * tile_size);
-
-            /* Check if the color range is limited */
-            if (color_range != AVCOL_RANGE_JPEG)
-            {
-                /* Prevent negative values after averaging the tile */
-                const float luma_norm = (tile_luma > color_range_lim_offs) ? tile_luma - color_range_lim_offs: 0; 
-                character_index = round(luma_norm / div_limited);
-            } 
-            else
-            {
-                character_index = round(tile_luma / div_full);
-            }
+    int64_t pts = frame->best_effort_timestamp;
+    if (pts == AV_NOPTS_VALUE)
+    {
+        /* Continue from the previous frame at the nominal rate */
+        pts = (clock->last_pts == AV_NOPTS_VALUE) ? 0 :
+                clock->last_pts + av_rescale_q(clock->frame_duration.count(), AVRational{1, us_per_sec}, clock->time_base);
+    }
+    clock->last_pts = pts;
 
-            ascii_buffer[cellId] = characters[character_index];
-        }
+    const auto now = std::chrono::steady_clock::now();
+    if (!clock->started)
+    {
+        clock->started = true;
+        clock->start_pts = pts;
+        clock->start_time = now;
+    }
 
-        /* Draw line by line to control lineheight */
-        FC_Draw(fc_font, renderer, 0, heightIdx * line_height_mult, "%s", ascii_buffer);
+    const auto due = present_clock_time(clock, pts);
+    if (due > now + max_present_wait || due < now - max_present_lag)
+    {
+        return present_clock_resync(clock);
     }
 
-    /* Update viewport */
-    SDL_RenderPresent(renderer);
+    return due;
+}
+
+/**
+ * @brief Records how far from its due time a frame was presented
+ * 
+ * @param clock pointer to presentation clock
+ * @param due time the frame was scheduled for
+ */
+static void present_clock_presented(TPresentClock* clock, std::chrono::steady_clock::time_point due)
+{
+    const double drift_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - due).count();
+
+    clock->presented++;
+    clock->drift_sum_ms += drift_ms;
+    clock->drift_max_ms = std::max(clock->drift_max_ms, drift_ms);
+}
+
+/**
+ * @brief Gets the playable range of the video stream
+ * 
+ * @param ffmpegctx pointer to ffmpeg context
+ * @param start receives the first timestamp in stream time base
+ * @param duration receives the length in stream time base, 0 if unknown
+ */
+static void stream_range(TFfmpegCtx* ffmpegctx, int64_t* start, int64_t* duration)
+{
+    AVStream* stream = ffmpegctx->stream;
+
+    *start = (stream->start_time != AV_NOPTS_VALUE) ? stream->start_time : 0;
+    if (stream->duration != AV_NOPTS_VALUE && stream->duration > 0)
+    {
+        *duration = stream->duration;
+    }
+    else if (ffmpegctx->input_ctx->duration != AV_NOPTS_VALUE && ffmpegctx->input_ctx->duration > 0)
+    {
+        *duration = av_rescale_q(ffmpegctx->input_ctx->duration, AVRational{1, AV_TIME_BASE}, stream->time_base);
+    }
+    else
+    {
+        *duration = 0;
+    }
+}
+
+/**
+ * @brief Requests a seek clamped to the stream, the demux thread performs it
+ * 
+ * @param ffmpegctx pointer to ffmpeg context
+ * @param queue pointer to packet queue
+ * @param position current position in stream time base, set to the target
+ * @param target requested position in stream time base
+ */
+static void seek_player(TFfmpegCtx* ffmpegctx, TPacketQueue* queue, int64_t* position, int64_t target)
+{
+    int64_t start, duration;
+
+    stream_range(ffmpegctx, &start, &duration);
+    target = std::max(target, start);
+    if (duration > 0)
+    {
+        target = std::min(target, start + duration);
+    }
+
+    *position = target;
+    packet_queue_request_seek(queue, target);
+}
+
+/**
+ * @brief Seeks relative to the current position
+ * 
+ * @param ffmpegctx pointer to ffmpeg context
+ * @param queue pointer to packet queue
+ * @param position current position in stream time base
+ * @param seconds distance to seek, negative to seek back
+ */
+static void seek_player_by(TFfmpegCtx* ffmpegctx, TPacketQueue* queue, int64_t* position, int seconds)
+{
+    seek_player(ffmpegctx, queue, position, *position + av_rescale_q(seconds, AVRational{1, 1}, ffmpegctx->stream->time_base));
+}
+
+/**
+ * @brief Seeks to the point of the video that corresponds to a horizontal window position
+ * 
+ * @param sdlctx pointer to SDL context
+ * @param ffmpegctx pointer to ffmpeg context
+ * @param queue pointer to packet queue
+ * @param position current position in stream time base
+ * @param x mouse position in window coordinates
+ */
+static void scrub_player(TSDLContext* sdlctx, TFfmpegCtx* ffmpegctx, TPacketQueue* queue, int64_t* position, int x)
+{
+    int64_t start, duration;
+    int width, height;
+
+    stream_range(ffmpegctx, &start, &duration);
+    SDL_GetWindowSize(sdlctx->window, &width, &height);
+    if (duration <= 0 || width <= 0)
+    {
+        return;
+    }
+
+    seek_player(ffmpegctx, queue, position, start + av_rescale(duration, std::clamp(x, 0, width), width));
+}
+
+/**
+ * @brief Prints presented and dropped frame counts and presentation drift
+ * 
+ * @param clock pointer to presentation clock
+ */
+static void print_present_report(const TPresentClock* clock)
+{
+    printf("presented: %zu frames, dropped %zu late frames\n", clock->presented, clock->dropped);
+    if (clock->presented > 0)
+    {
+        printf("drift:     mean %.3f ms   max %.3f ms\n", clock->drift_sum_ms / clock->presented, clock->drift_max_ms);
+    }
+    fflush(stdout);
+}
+
+/**
+ * @brief Prints median, 99th percentile and mean of one stage
+ * 
+ * @param name stage name
+ * @param samples stage timings in milliseconds, sorted in place
+ */
+static void print_stage_stats(const char* name, vector<double>& samples)
+{
+    if (samples.empty())
+    {
+        return;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (const double sample : samples)
+    {
+        total += sample;
+    }
+
+    printf("%-10s p50 %8.3f ms   p99 %8.3f ms   mean %8.3f ms\n", name,
+            samples[(samples.size() - 1) / 2], samples[(size_t)((samples.size() - 1) * 0.99)], total / samples.size());
+}
+
+/**
+ * @brief Prints benchmark results
+ * 
+ * @param stats pointer to collected timings
+ * @param frames number of frames shown
+ * @param elapsed wall time from first to last frame
+ */
+static void print_bench_report(TBenchStats* stats, size_t frames, std::chrono::steady_clock::duration elapsed)
+{
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+
+    printf("frames:    %zu in %.3f s (%.2f fps)\n", frames, seconds, seconds > 0 ? frames / seconds : 0.0);
+    print_stage_stats("decode", stats->decode_ms);
+    print_stage_stats("convert", stats->convert_ms);
+    print_stage_stats("render", stats->render_ms);
+    fflush(stdout);
 }
 
 int main(int argc, char *argv[])
 {
     TSDLContext sdlctx = {0};
     TFfmpegCtx ffmpegctx = {0};
+    TPlayerOptions options;
+    TFrameQueue frame_queue;
+    TPacketQueue packet_queue;
+    TConvertCtx convctx;
+    TTermOutput term;
+    TBenchStats bench_stats;
+    TPresentClock present_clock;
+    TKeyframeIndex keyframe_index;
 
-    int ret = 0;
     bool done = false;
-    char* ascii_buffer = nullptr;
 
-    if (argc < 2) 
+    if (parse_options(argc, argv, &options)) 
     {
-        std::cout << "Usage: ascii_player <file>" << std::endl;
+        print_usage();
         return 1;
     }
 
-    if (init_ffmpeg(&ffmpegctx, argv[1]))
+    if (init_ffmpeg(&ffmpegctx, &options))
+    {
+        cleanup(1, &sdlctx, &ffmpegctx);
+        return -1;
+    }
+
+    if (options.output_mode == OUTPUT_SDL)
+    {
+        init_font_cache(&options);
+    }
+
+    /* Ramp and edge glyphs, rasterized by the font cache and baked for composite rendering */
+    const std::string glyph_set = make_glyph_set(&options);
+    if (options.output_mode == OUTPUT_SDL && init_sdl(&sdlctx, !options.bench, glyph_set.c_str()))
     {
         cleanup(1, &sdlctx, &ffmpegctx);
         return -1;
     }
 
-    if (init_sdl(&sdlctx))
+    if (frame_queue_init(&frame_queue, options.frame_queue_depth) || packet_queue_init(&packet_queue, packet_queue_depth))
     {
+        std::cerr << "Error allocating frame and packet queues" << std::endl;
+        packet_queue_destroy(&packet_queue);
+        frame_queue_destroy(&frame_queue);
         cleanup(1, &sdlctx, &ffmpegctx);
         return -1;
     }
     
-    /* Calculate frame time */
-    const auto frametime = std::chrono::milliseconds(ms_per_sec / (int)av_q2d(ffmpegctx.stream->r_frame_rate));
+    /* Frames are scheduled by their timestamps */
+    present_clock_init(&present_clock, ffmpegctx.stream);
 
-    /* Allocate ASCII frame */
-    ascii_buffer = (char*)malloc(ffmpegctx.stream->codecpar->width / tile_size);
+    /* Allocate ASCII frame and conversion buffers */
+    if (init_convert(&convctx, ffmpegctx.stream->codecpar->width, ffmpegctx.stream->codecpar->height, ffmpegctx.lowres, &options))
+    {
+        std::cerr << "Error allocating conversion buffers" << std::endl;
+        packet_queue_destroy(&packet_queue);
+        frame_queue_destroy(&frame_queue);
+        cleanup(1, &sdlctx, &ffmpegctx);
+        return -1;
+    }
 
-    /* Update window size now that we know content dimensions */
-    update_window_size(sdlctx.fc_font, ffmpegctx.stream, sdlctx.window);
+    cout << "kernel: " << convctx.kernel_name << " " << convctx.tile_w << 'x' << convctx.tile_h << endl;
 
-    do
+    if (options.output_mode == OUTPUT_TERM)
+    {
+        signal(SIGINT, handle_interrupt);
+        term_output_init(&term, stdout, convctx.cols, convctx.rows);
+    }
+    else
+    {
+        /* Update window size now that we know content dimensions */
+        update_window_size(sdlctx.fc_font, ffmpegctx.stream, options.tile_width, sdlctx.window);
+
+        /* Rows are placed according to the tile height */
+        sdlctx.render_mode = options.render_mode;
+        sdlctx.line_height = options.tile_height * line_height_mult;
+        if (convctx.glyph_mode == GLYPHS_SHAPE && init_shape_glyphs(&convctx, sdlctx.fc_font, sdlctx.line_height, options.ramp, options.ramp_len))
+        {
+            free_convert(&convctx);
+            packet_queue_destroy(&packet_queue);
+            frame_queue_destroy(&frame_queue);
+            cleanup(1, &sdlctx, &ffmpegctx);
+            return -1;
+        }
+        if (sdlctx.render_mode == RENDER_COMPOSITE && init_composite(&sdlctx, glyph_set.c_str(), (int)glyph_set.size(), convctx.cols, convctx.rows))
+        {
+            free_convert(&convctx);
+            packet_queue_destroy(&packet_queue);
+            frame_queue_destroy(&frame_queue);
+            cleanup(1, &sdlctx, &ffmpegctx);
+            return -1;
+        }
+        init_delta(&sdlctx, convctx.cols, convctx.rows, !options.full_redraw);
+    }
+
+    /* Seeks start from here until the first frame is shown */
+    int64_t position = 0;
+    int64_t stream_duration = 0;
+    int shown_serial = 0;
+    stream_range(&ffmpegctx, &position, &stream_duration);
+    if (options.start > 0)
+    {
+        seek_player(&ffmpegctx, &packet_queue, &position,
+                    position + av_rescale_q((int64_t)(options.start * AV_TIME_BASE), AVRational{1, AV_TIME_BASE}, ffmpegctx.stream->time_base));
+    }
+
+    /* Keyframes are indexed for interactive seeking only */
+    if (options.output_mode == OUTPUT_SDL && !options.bench && keyframe_index_wanted(&ffmpegctx))
     {
-        auto now = std::chrono::system_clock::now();
-        auto start = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch());
+        keyframe_index.thread = std::thread(keyframe_index_thread, &keyframe_index, options.file, ffmpegctx.input.mode, ffmpegctx.stream);
+    }
+
+    /* Demuxing and decoding run ahead of presentation on their own threads */
+    std::thread demuxer(demux_thread, &ffmpegctx, &packet_queue, &keyframe_index);
+    std::thread decoder(decode_thread, &ffmpegctx, &packet_queue, &frame_queue, options.bench ? &bench_stats : nullptr);
+    auto bench_start = std::chrono::steady_clock::now();
+    size_t frames_shown = 0;
 
+    do
+    {
         /* Detect quit attempt or button press */
         while (SDL_PollEvent(&sdlctx.event))
         {
             switch (sdlctx.event.type) 
             {
                 case SDL_KEYDOWN:
+                    switch (sdlctx.event.key.keysym.sym)
+                    {
+                        case SDLK_LEFT:
+                            seek_player_by(&ffmpegctx, &packet_queue, &position, -seek_step_short);
+                            break;
+                        case SDLK_RIGHT:
+                            seek_player_by(&ffmpegctx, &packet_queue, &position, seek_step_short);
+                            break;
+                        case SDLK_DOWN:
+                            seek_player_by(&ffmpegctx, &packet_queue, &position, -seek_step_long);
+                            break;
+                        case SDLK_UP:
+                            seek_player_by(&ffmpegctx, &packet_queue, &position, seek_step_long);
+                            break;
+                        case SDLK_ESCAPE:
+                        case SDLK_q:
+                            done = true;
+                            break;
+                        default:
+                            break;
+                    }
+                    break;
+                case SDL_MOUSEBUTTONDOWN:
+                    if (sdlctx.event.button.button == SDL_BUTTON_LEFT)
+                    {
+                        scrub_player(&sdlctx, &ffmpegctx, &packet_queue, &position, sdlctx.event.button.x);
+                    }
+                    break;
+                case SDL_MOUSEMOTION:
+                    if (sdlctx.event.motion.state & SDL_BUTTON_LMASK)
+                    {
+                        scrub_player(&sdlctx, &ffmpegctx, &packet_queue, &position, sdlctx.event.motion.x);
+                    }
+                    break;
                 case SDL_QUIT:
                     done = true;
                     break;
+                case SDL_RENDER_TARGETS_RESET:
+                case SDL_RENDER_DEVICE_RESET:
+                    /* Canvas content was lost */
+                    sdlctx.delta.valid = false;
+                    break;
                 default:
                     break;
             }
         }
+        done = done || interrupted;
         
-        /* Decode next frame from file if there are any */
-        ret = get_frame(&ffmpegctx);
-        if (ret > 0)
+        /* Take next decoded frame if there are any */
+        int serial = 0;
+        AVFrame* frame = frame_queue_peek_readable(&frame_queue, std::max(std::chrono::milliseconds(1),
+                                                   std::chrono::duration_cast<std::chrono::milliseconds>(present_clock.frame_duration)), &serial);
+        if (!frame)
         {
-            /* Not enough data to decode whole frame, try again */
+            /* Decoder is behind, keep handling events */
             continue;
         }
-        else if (ret < 0)
+
+        /* Frames decoded before the latest seek are stale */
+        if (serial != packet_queue_serial(&packet_queue))
         {
-            /* Something went wrong */
-            break;
+            frame_queue_next(&frame_queue);
+            continue;
+        }
+        if (serial != shown_serial)
+        {
+            present_clock_reset(&present_clock);
+            shown_serial = serial;
+        }
+
+        auto due = present_clock_due(&present_clock, frame);
+        /* While a seek is pending, frames from before it must not move the position relative seeks start from */
+        if (packet_queue_settled(&packet_queue, serial))
+        {
+            position = present_clock.last_pts;
+        }
+        if (!options.bench && std::chrono::steady_clock::now() > due)
+        {
+            /* Skipping a late frame only catches up if the next one is already due as well,
+               otherwise nothing would be shown while the decoder is slower than real time */
+            int next_serial = 0;
+            AVFrame* next = frame_queue_peek_next(&frame_queue, &next_serial);
+            const auto now = std::chrono::steady_clock::now();
+            if (next && next_serial == serial && next->best_effort_timestamp != AV_NOPTS_VALUE &&
+                present_clock_time(&present_clock, next->best_effort_timestamp) < now)
+            {
+                present_clock.dropped++;
+                frame_queue_next(&frame_queue);
+                continue;
+            }
+            if (now - due > present_resync_threshold)
+            {
+                due = present_clock_resync(&present_clock);
+            }
+        }
+
+        if (frames_shown++ == 0)
+        {
+            bench_start = std::chrono::steady_clock::now();
         }
 
         /* Process pixel data and render it as ASCII */
-        handle_frame(sdlctx.renderer, sdlctx.fc_font, ffmpegctx.decframe, ffmpegctx.stream->codecpar->color_range, ascii_buffer);
+        const auto convert_start = std::chrono::steady_clock::now();
+        convert_frame(frame, ffmpegctx.stream->codecpar->color_range, &convctx, convctx.ascii);
+        frame_queue_next(&frame_queue);
+
+        /* Wait until we need to present the frame */
+        if (!options.bench)
+        {
+            std::this_thread::sleep_until(due);
+        }
+
+        const auto render_start = std::chrono::steady_clock::now();
+        if (options.output_mode == OUTPUT_TERM)
+        {
+            term_output_frame(&term, convctx.ascii, convctx.colors, convctx.colors_linesize);
+        }
+        else
+        {
+            render_frame(&sdlctx, convctx.ascii, convctx.cols, convctx.rows, convctx.colors, convctx.colors_linesize);
+        }
 
-        /* Wait until we need to present next frame */
-        now = std::chrono::system_clock::now();
-        auto end = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch());
-        if ((end - start) < frametime)
+        if (options.bench)
         {
-            std::this_thread::sleep_for(frametime - (end - start));
+            /* Run as fast as possible, only record how long each stage took */
+            const auto render_end = std::chrono::steady_clock::now();
+            bench_stats.convert_ms.push_back(std::chrono::duration<double, std::milli>(render_start - convert_start).count());
+            bench_stats.render_ms.push_back(std::chrono::duration<double, std::milli>(render_end - render_start).count());
+            continue;
         }
+
+        present_clock_presented(&present_clock, due);
+    }
+    while (!playback_finished(&frame_queue, &packet_queue) && (done == false));
+
+    /* Stop demuxer and decoder before tearing down their contexts */
+    frame_queue_stop(&frame_queue, true);
+    packet_queue_stop(&packet_queue, true);
+    decoder.join();
+    demuxer.join();
+    keyframe_index.stop = true;
+    if (keyframe_index.thread.joinable())
+    {
+        keyframe_index.thread.join();
+    }
+    frame_queue_destroy(&frame_queue);
+    packet_queue_destroy(&packet_queue);
+
+    if (options.output_mode == OUTPUT_TERM)
+    {
+        term_output_close(&term);
+    }
+
+    if (options.bench)
+    {
+        print_bench_report(&bench_stats, frames_shown, std::chrono::steady_clock::now() - bench_start);
+    }
+    else
+    {
+        print_present_report(&present_clock);
     }
-    while ((!ffmpegctx.end_of_stream || ffmpegctx.got_image) && (done == false));
     
-    /* Release ASCII frame */
-    free(ascii_buffer);
+    /* Release ASCII frame and conversion buffers */
+    free_convert(&convctx);
 
     cleanup(0, &sdlctx, &ffmpegctx);
 
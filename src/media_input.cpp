@@ -0,0 +1,302 @@
+#include "media_input.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+#include <libavutil/mem.h>
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MEDIA_INPUT_POSIX
+#endif
+
+/* Buffer avformat parses from, refilled by the read callbacks */
+static const int avio_buffer_size = 64 * 1024;
+/* Large reads keep network file systems streaming instead of issuing a request per packet */
+static const int readahead_chunk_size = 1024 * 1024;
+static const int readahead_chunk_count = 8;
+static const size_t chunk_alignment = 4096;
+
+#ifdef MEDIA_INPUT_POSIX
+
+/* Resolves an avio seek request to an absolute position, or -1 */
+static int64_t seek_target(TMediaInput* input, int64_t offset, int whence)
+{
+    switch (whence & ~AVSEEK_FORCE)
+    {
+        case SEEK_SET: return offset;
+        case SEEK_CUR: return input->pos + offset;
+        case SEEK_END: return input->size + offset;
+        default:       return -1;
+    }
+}
+
+static int64_t input_seek(void* opaque, int64_t offset, int whence)
+{
+    TMediaInput* input = (TMediaInput*)opaque;
+
+    if (whence == AVSEEK_SIZE)
+    {
+        return input->size;
+    }
+
+    const int64_t target = seek_target(input, offset, whence);
+    if (target < 0)
+    {
+        return AVERROR(EINVAL);
+    }
+
+    std::lock_guard<std::mutex> lock(input->mutex);
+    input->pos = target;
+    return target;
+}
+
+static int mmap_read(void* opaque, uint8_t* buf, int buf_size)
+{
+    TMediaInput* input = (TMediaInput*)opaque;
+
+    if (input->pos >= input->size)
+    {
+        return AVERROR_EOF;
+    }
+
+    const int len = (int)std::min<int64_t>(buf_size, input->size - input->pos);
+    memcpy(buf, input->map + input->pos, len);
+    input->pos += len;
+    return len;
+}
+
+/* Fills free ring slots in file order, restarting whenever the demuxer seeks outside the buffered range */
+static void readahead_thread(TMediaInput* input)
+{
+    std::unique_lock<std::mutex> lock(input->mutex);
+
+    while (!input->stop)
+    {
+        if (input->filled == input->chunk_count || input->next_offset >= input->size || input->error)
+        {
+            input->cond.wait(lock);
+            continue;
+        }
+
+        TInputChunk* chunk = &input->chunks[(input->head + input->filled) % input->chunk_count];
+        const int64_t offset = input->next_offset;
+        const unsigned generation = input->generation;
+
+        /* The slot is outside the filled range, so the demuxer does not touch it while we read */
+        lock.unlock();
+        ssize_t len = pread(input->fd, chunk->data, input->chunk_size, offset);
+        lock.lock();
+
+        if (generation != input->generation)
+        {
+            /* Demuxer seeked meanwhile, the data belongs to the old position */
+            continue;
+        }
+
+        if (len <= 0)
+        {
+            input->error = (len == 0) ? AVERROR_EOF : AVERROR(errno);
+        }
+        else
+        {
+            chunk->offset = offset;
+            chunk->len = (int)len;
+            input->next_offset += len;
+            input->filled++;
+        }
+        input->cond.notify_all();
+    }
+}
+
+static int readahead_read(void* opaque, uint8_t* buf, int buf_size)
+{
+    TMediaInput* input = (TMediaInput*)opaque;
+    std::unique_lock<std::mutex> lock(input->mutex);
+
+    if (input->pos >= input->size)
+    {
+        return AVERROR_EOF;
+    }
+
+    for (;;)
+    {
+        /* Release chunks the demuxer has moved past, they make room for the reader thread */
+        while (input->filled > 0)
+        {
+            const TInputChunk* chunk = &input->chunks[input->head];
+            if (input->pos >= chunk->offset && input->pos < chunk->offset + chunk->len)
+            {
+                const int start = (int)(input->pos - chunk->offset);
+                const int len = std::min(buf_size, chunk->len - start);
+                memcpy(buf, chunk->data + start, len);
+                input->pos += len;
+                if (start + len == chunk->len)
+                {
+                    input->head = (input->head + 1) % input->chunk_count;
+                    input->filled--;
+                    input->cond.notify_all();
+                }
+                return len;
+            }
+            if (input->pos < chunk->offset || input->pos > input->next_offset)
+            {
+                break;
+            }
+            input->head = (input->head + 1) % input->chunk_count;
+            input->filled--;
+            input->cond.notify_all();
+        }
+
+        if (input->filled > 0 || input->pos != input->next_offset)
+        {
+            /* Seek outside the buffered range, restart reading ahead from the new position */
+            input->filled = 0;
+            input->next_offset = input->pos;
+            input->error = 0;
+            input->generation++;
+            input->cond.notify_all();
+        }
+        else if (input->error)
+        {
+            return input->error;
+        }
+
+        input->cond.wait(lock);
+    }
+}
+
+int media_input_open(TMediaInput* input, const char* file, EInputMode mode)
+{
+    struct stat st;
+
+    input->mode = mode;
+    input->fd = open(file, O_RDONLY);
+    if (input->fd < 0)
+    {
+        return 1;
+    }
+
+    if (fstat(input->fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        media_input_close(input);
+        return 1;
+    }
+    input->size = st.st_size;
+
+    if (mode == INPUT_MMAP)
+    {
+        void* map = mmap(nullptr, input->size, PROT_READ, MAP_PRIVATE, input->fd, 0);
+        if (map == MAP_FAILED)
+        {
+            media_input_close(input);
+            return 2;
+        }
+        input->map = (uint8_t*)map;
+        /* Packets are read front to back, let the kernel fetch pages ahead of the demuxer */
+        madvise(input->map, input->size, MADV_SEQUENTIAL);
+    }
+    else
+    {
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(input->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        input->chunk_count = readahead_chunk_count;
+        input->chunk_size = readahead_chunk_size;
+        input->chunks = (TInputChunk*)av_mallocz(sizeof(TInputChunk) * input->chunk_count);
+        if (!input->chunks)
+        {
+            media_input_close(input);
+            return 2;
+        }
+        for (int i = 0; i < input->chunk_count; i++)
+        {
+            input->chunks[i].data = (uint8_t*)aligned_alloc(chunk_alignment, input->chunk_size);
+            if (!input->chunks[i].data)
+            {
+                media_input_close(input);
+                return 2;
+            }
+        }
+        input->reader = std::thread(readahead_thread, input);
+    }
+
+    uint8_t* avio_buffer = (uint8_t*)av_malloc(avio_buffer_size);
+    if (avio_buffer)
+    {
+        input->avio = avio_alloc_context(avio_buffer, avio_buffer_size, 0, input,
+                                            (mode == INPUT_MMAP) ? mmap_read : readahead_read, nullptr, input_seek);
+    }
+    if (!input->avio)
+    {
+        av_free(avio_buffer);
+        media_input_close(input);
+        return 2;
+    }
+
+    return 0;
+}
+
+void media_input_close(TMediaInput* input)
+{
+    if (input->reader.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(input->mutex);
+            input->stop = true;
+        }
+        input->cond.notify_all();
+        input->reader.join();
+    }
+
+    if (input->avio)
+    {
+        /* avformat may have replaced the buffer we passed in */
+        av_freep(&input->avio->buffer);
+        avio_context_free(&input->avio);
+    }
+
+    if (input->chunks)
+    {
+        for (int i = 0; i < input->chunk_count; i++)
+        {
+            free(input->chunks[i].data);
+        }
+        av_freep(&input->chunks);
+    }
+
+    if (input->map)
+    {
+        munmap(input->map, input->size);
+        input->map = nullptr;
+    }
+
+    if (input->fd >= 0)
+    {
+        close(input->fd);
+        input->fd = -1;
+    }
+}
+
+#else
+
+int media_input_open(TMediaInput* input, const char* file, EInputMode mode)
+{
+    /* Custom I/O needs POSIX file access, avformat's own I/O is used instead */
+    return 1;
+}
+
+void media_input_close(TMediaInput* input)
+{
+}
+
+#endif
@@ -0,0 +1,158 @@
+#include "term_output.h"
+
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/ioctl.h>
+#include <unistd.h>
+#define TERM_OUTPUT_WINSIZE
+#endif
+
+/* Cursor positions are 1-based: ESC [ row ; col H */
+static void append_move(std::vector<char>& out, int row, int col)
+{
+    char seq[24];
+    const int len = snprintf(seq, sizeof(seq), "\x1b[%d;%dH", row + 1, col + 1);
+    out.insert(out.end(), seq, seq + len);
+}
+
+static int move_cost(int row, int col)
+{
+    char seq[24];
+    return snprintf(seq, sizeof(seq), "\x1b[%d;%dH", row + 1, col + 1);
+}
+
+/* Index into the 6x6x6 color cube of the xterm 256 color palette */
+static uint8_t cube_index(const uint8_t* rgba)
+{
+    return 16 + 36 * ((rgba[0] * 5 + 127) / 255) + 6 * ((rgba[1] * 5 + 127) / 255) + (rgba[2] * 5 + 127) / 255;
+}
+
+/* Appends characters start..end of a row, switching the foreground color only when it changes */
+static void append_cells(std::vector<char>& out, const char* line, const uint8_t* colors, int start, int end, int* current_color)
+{
+    if (colors == nullptr)
+    {
+        out.insert(out.end(), &line[start], &line[end]);
+        return;
+    }
+
+    for (int col = start; col < end; col++)
+    {
+        if (colors[col] != *current_color)
+        {
+            char seq[16];
+            const int len = snprintf(seq, sizeof(seq), "\x1b[38;5;%dm", colors[col]);
+            out.insert(out.end(), seq, seq + len);
+            *current_color = colors[col];
+        }
+        out.push_back(line[col]);
+    }
+}
+
+int term_output_init(TTermOutput* term, FILE* stream, int cols, int rows)
+{
+    term->stream = stream;
+    term->cols = cols;
+    term->rows = rows;
+    term->visible_cols = cols;
+    term->visible_rows = rows;
+
+#ifdef TERM_OUTPUT_WINSIZE
+    /* Anything past the window edge would wrap and scroll, so crop to the window */
+    struct winsize ws;
+    if (ioctl(fileno(stream), TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0)
+    {
+        term->visible_cols = (cols < ws.ws_col) ? cols : ws.ws_col;
+        term->visible_rows = (rows < ws.ws_row) ? rows : ws.ws_row;
+    }
+#endif
+
+    /* No frame has been written yet, so every cell counts as changed */
+    term->prev.assign(cols * rows, '\0');
+    term->colors.assign(cols * rows, 0);
+    term->prev_colors.assign(cols * rows, 0);
+    term->out.clear();
+    term->out.reserve(cols * rows * 2);
+
+    fputs("\x1b[?25l\x1b[2J", stream);
+    fflush(stream);
+    return 0;
+}
+
+size_t term_output_frame(TTermOutput* term, const char* ascii_buffer, const uint8_t* rgba, int rgba_pitch)
+{
+    std::vector<char>& out = term->out;
+    int cursor_row = -1;
+    int cursor_col = -1;
+    int current_color = -1;
+
+    out.clear();
+    for (int row = 0; row < term->visible_rows; row++)
+    {
+        const char* line = &ascii_buffer[row * term->cols];
+        char* prev = &term->prev[row * term->cols];
+        uint8_t* colors = nullptr;
+        uint8_t* prev_colors = nullptr;
+        int col = 0;
+
+        if (rgba != nullptr)
+        {
+            colors = &term->colors[row * term->cols];
+            prev_colors = &term->prev_colors[row * term->cols];
+            for (int i = 0; i < term->visible_cols; i++)
+            {
+                colors[i] = cube_index(&rgba[row * rgba_pitch + i * 4]);
+            }
+        }
+
+        while (col < term->visible_cols)
+        {
+            if (line[col] == prev[col] && (colors == nullptr || colors[col] == prev_colors[col]))
+            {
+                col++;
+                continue;
+            }
+
+            /* Skip over unchanged cells by rewriting them when that is shorter than a cursor move */
+            if (row == cursor_row && col > cursor_col && col - cursor_col < move_cost(row, col))
+            {
+                append_cells(out, line, colors, cursor_col, col, &current_color);
+            }
+            else if (row != cursor_row || col != cursor_col)
+            {
+                append_move(out, row, col);
+            }
+
+            /* Write the run of changed cells */
+            const int start = col;
+            while (col < term->visible_cols && (line[col] != prev[col] || (colors != nullptr && colors[col] != prev_colors[col])))
+            {
+                col++;
+            }
+            append_cells(out, line, colors, start, col, &current_color);
+            memcpy(&prev[start], &line[start], col - start);
+            if (colors != nullptr)
+            {
+                memcpy(&prev_colors[start], &colors[start], col - start);
+            }
+
+            cursor_row = row;
+            cursor_col = col;
+        }
+    }
+
+    if (!out.empty())
+    {
+        fwrite(out.data(), 1, out.size(), term->stream);
+        fflush(term->stream);
+    }
+
+    return out.size();
+}
+
+void term_output_close(TTermOutput* term)
+{
+    fprintf(term->stream, "\x1b[0m\x1b[%d;1H\x1b[?25h\n", term->visible_rows + 1);
+    fflush(term->stream);
+}